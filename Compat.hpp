@@ -15,6 +15,7 @@
 # include <memory>
 # include <string>
 
+# include <pthread.h>
 # include <stdint.h>
 
 // Includes for to_string()
@@ -41,6 +42,31 @@ namespace std
 
     return retval;
   }
+
+  // Need C++11 mutex and lock_guard equivalents
+  class mutex
+  {
+  public:
+    mutex() { pthread_mutex_init(&iMutex, NULL); }
+    ~mutex() { pthread_mutex_destroy(&iMutex); }
+    void lock() { pthread_mutex_lock(&iMutex); }
+    void unlock() { pthread_mutex_unlock(&iMutex); }
+  private:
+    mutex(const mutex&);
+    mutex& operator=(const mutex&);
+    pthread_mutex_t iMutex;
+  };
+
+  template <class Mutex> class lock_guard
+  {
+  public:
+    explicit lock_guard(Mutex& m) : iMutex(m) { iMutex.lock(); }
+    ~lock_guard() { iMutex.unlock(); }
+  private:
+    lock_guard(const lock_guard&);
+    lock_guard& operator=(const lock_guard&);
+    Mutex& iMutex;
+  };
 };
 #endif
 
@@ -0,0 +1,122 @@
+/********************************************************* {COPYRIGHT-TOP} ***
+* Copyright 2016 IBM Corporation
+*
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the MIT License
+* which accompanies this distribution, and is available at
+* http://opensource.org/licenses/MIT
+********************************************************** {COPYRIGHT-END} **/
+
+#include "FrameCodec.hpp"
+
+#include <stdexcept>
+
+namespace {
+
+  /*
+   * Append an unsigned LEB128 varint; values below 128 take a single byte,
+   * which covers nearly every prefix and suffix length we send.
+   */
+  void appendVarint(std::string& out, size_t value) {
+    while (value >= 0x80) {
+      out += static_cast<char>((value & 0x7F) | 0x80);
+      value >>= 7;
+    }
+    out += static_cast<char>(value);
+  }
+
+  size_t readVarint(const std::string& in, size_t& offset) {
+    size_t value = 0;
+    unsigned shift = 0;
+    while (offset < in.length() && shift < 35) {
+      unsigned char byte = static_cast<unsigned char>(in[offset++]);
+      value |= static_cast<size_t>(byte & 0x7F) << shift;
+      if ((byte & 0x80) == 0) {
+        return value;
+      }
+      shift += 7;
+    }
+    throw std::runtime_error("Truncated varint in frame");
+  }
+
+}
+
+FrameEncoder::FrameEncoder()
+ : iFrame(HEADER_SIZE, '\0') {
+}
+
+void FrameEncoder::append(const char* line, size_t length) {
+  size_t shared = 0;
+  size_t limit = length < iPrevious.length() ? length : iPrevious.length();
+  while (shared < limit && line[shared] == iPrevious[shared]) {
+    ++shared;
+  }
+  appendVarint(iFrame, shared);
+  appendVarint(iFrame, length - shared);
+  iFrame.append(line + shared, length - shared);
+  iPrevious.assign(line, length);
+}
+
+const std::string& FrameEncoder::finish() {
+  size_t length = iFrame.length() - HEADER_SIZE;
+  iFrame[0] = static_cast<char>((length >> 24) & 0xFF);
+  iFrame[1] = static_cast<char>((length >> 16) & 0xFF);
+  iFrame[2] = static_cast<char>((length >> 8) & 0xFF);
+  iFrame[3] = static_cast<char>(length & 0xFF);
+  return iFrame;
+}
+
+void FrameEncoder::reset() {
+  iFrame.assign(HEADER_SIZE, '\0');
+  iPrevious.clear();
+}
+
+FrameDecoder::FrameDecoder() {
+}
+
+void FrameDecoder::feed(const char* data, size_t length) {
+  iPending.append(data, length);
+  while (iPending.length() >= FrameEncoder::HEADER_SIZE) {
+    size_t payloadLength = FrameDecoder::payloadLength(iPending.data());
+    if (payloadLength > MAX_FRAME_SIZE) {
+      throw std::runtime_error("Frame exceeds maximum size");
+    }
+    if (iPending.length() < FrameEncoder::HEADER_SIZE + payloadLength) {
+      return;
+    }
+    decodePayload(iPending.substr(FrameEncoder::HEADER_SIZE, payloadLength));
+    iPending.erase(0, FrameEncoder::HEADER_SIZE + payloadLength);
+  }
+}
+
+size_t FrameDecoder::payloadLength(const char* header) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(header);
+  return (static_cast<size_t>(bytes[0]) << 24) | (static_cast<size_t>(bytes[1]) << 16) |
+         (static_cast<size_t>(bytes[2]) << 8) | static_cast<size_t>(bytes[3]);
+}
+
+bool FrameDecoder::next(std::string& line) {
+  if (iLines.empty()) {
+    return false;
+  }
+  line.swap(iLines.front());
+  iLines.pop_front();
+  return true;
+}
+
+void FrameDecoder::decodePayload(const std::string& payload) {
+  std::string previous;
+  size_t offset = 0;
+  while (offset < payload.length()) {
+    size_t shared = readVarint(payload, offset);
+    size_t suffix = readVarint(payload, offset);
+    if (shared > previous.length() || suffix > payload.length() - offset) {
+      throw std::runtime_error("Corrupt line in frame");
+    }
+    std::string line(previous, 0, shared);
+    line.append(payload, offset, suffix);
+    offset += suffix;
+    iLines.push_back(line);
+    previous.swap(line);
+  }
+}
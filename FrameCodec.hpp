@@ -0,0 +1,76 @@
+/********************************************************* {COPYRIGHT-TOP} ***
+* Copyright 2016 IBM Corporation
+*
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the MIT License
+* which accompanies this distribution, and is available at
+* http://opensource.org/licenses/MIT
+********************************************************** {COPYRIGHT-END} **/
+
+#ifndef FrameCodec_hpp
+#define FrameCodec_hpp
+
+#include <deque>
+#include <string>
+
+/*
+ * Binary framing used by the tcp-framed protocol. Each frame is a 4 byte
+ * big-endian payload length followed by the payload. The payload is a
+ * sequence of StatsD lines, each front-coded against the previous line in
+ * the same frame:
+ *
+ *   varint sharedPrefixLength, varint suffixLength, suffix bytes
+ *
+ * Metrics for one message flow share a long hostname.node.server.flow.
+ * prefix, so after the first line only the metric name and value are sent.
+ */
+class FrameEncoder {
+
+public:
+
+  FrameEncoder();
+
+  void append(const std::string& line) { append(line.data(), line.length()); }
+  void append(const char* line, size_t length);
+  bool empty() const { return iFrame.length() == HEADER_SIZE; }
+
+  // Fills in the header and returns the complete frame.
+  const std::string& finish();
+  void reset();
+
+  static const size_t HEADER_SIZE = 4;
+
+private:
+
+  std::string iFrame;
+  std::string iPrevious;
+
+};
+
+class FrameDecoder {
+
+public:
+
+  FrameDecoder();
+
+  void feed(const char* data, size_t length);
+
+  // Returns false when no complete line is available yet. Throws
+  // std::runtime_error if the stream is corrupt.
+  bool next(std::string& line);
+
+  // Returns the payload length from a frame header of HEADER_SIZE bytes.
+  static size_t payloadLength(const char* header);
+
+  static const size_t MAX_FRAME_SIZE = 16 * 1024 * 1024;
+
+private:
+
+  std::string iPending;
+  std::deque<std::string> iLines;
+
+  void decodePayload(const std::string& payload);
+
+};
+
+#endif // FrameCodec_hpp
@@ -0,0 +1,153 @@
+/********************************************************* {COPYRIGHT-TOP} ***
+* Copyright 2016 IBM Corporation
+*
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the MIT License
+* which accompanies this distribution, and is available at
+* http://opensource.org/licenses/MIT
+********************************************************** {COPYRIGHT-END} **/
+
+#include "FramedTcpSocket.hpp"
+
+#include <algorithm>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/locale.hpp>
+
+using boost::asio::ip::tcp;
+using boost::locale::conv::utf_to_utf;
+
+const size_t FramedTcpSocket::MAX_BATCH_SIZE;
+
+namespace {
+
+  /*
+   * How long a connect or the write of one frame may take before the
+   * connection is abandoned, and the range of the delay before reconnecting,
+   * which doubles with each consecutive failure.
+   */
+  const long IO_TIMEOUT_MILLIS = 2000;
+  const long MIN_RETRY_DELAY_MILLIS = 1000;
+  const long MAX_RETRY_DELAY_MILLIS = 60000;
+
+  /*
+   * Completion handlers for the operations run by runWithTimeout(); they record
+   * the outcome and stop the timer.
+   */
+  struct ConnectHandler {
+    boost::system::error_code* iError;
+    bool* iDone;
+    boost::asio::deadline_timer* iTimer;
+    void operator()(const boost::system::error_code& error, tcp::resolver::iterator) {
+      *iError = error;
+      *iDone = true;
+      iTimer->cancel();
+    }
+  };
+
+  struct WriteHandler {
+    boost::system::error_code* iError;
+    bool* iDone;
+    boost::asio::deadline_timer* iTimer;
+    void operator()(const boost::system::error_code& error, size_t) {
+      *iError = error;
+      *iDone = true;
+      iTimer->cancel();
+    }
+  };
+
+  /*
+   * Closing the stream makes the pending operation complete with an error.
+   */
+  struct TimeoutHandler {
+    tcp::socket* iStream;
+    bool* iDone;
+    void operator()(const boost::system::error_code& error) {
+      if (!error && !*iDone) {
+        boost::system::error_code ignored;
+        iStream->close(ignored);
+      }
+    }
+  };
+
+}
+
+FramedTcpSocket::FramedTcpSocket(const std::u16string& hostname, const std::u16string& port, PacketPool* pool)
+ : UdpSocket(hostname, port, MAX_BATCH_SIZE, pool),
+   iStream(iIOService),
+   iTimer(iIOService),
+   iDone(false) {
+  tcp::resolver resolver(iIOService);
+  tcp::resolver::query query(tcp::v4(), utf_to_utf<char>(hostname), utf_to_utf<char>(port));
+  iEndpoints = resolver.resolve(query);
+}
+
+FramedTcpSocket::~FramedTcpSocket() {
+
+}
+
+/*
+ * Encode the newline separated batch as one frame and write it. The
+ * connection is made lazily and dropped on any error, so a relay restart
+ * loses at most one frame; as with UDP, StatsD data is best effort. While
+ * waiting to reconnect after a failure, frames are dropped.
+ */
+bool FramedTcpSocket::transmit(const char* packet, size_t length) {
+  iEncoder.reset();
+  const char* end = packet + length;
+  const char* start = packet;
+  for (;;) {
+    const char* newline = std::find(start, end, '\n');
+    iEncoder.append(start, newline - start);
+    if (newline == end) {
+      break;
+    }
+    start = newline + 1;
+  }
+
+  boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+  if (!iStream.is_open() && !iRetryAt.is_not_a_date_time() && now < iRetryAt) {
+    return false;
+  }
+  if ((iStream.is_open() || connect()) && write(iEncoder.finish())) {
+    iRetryAt = boost::posix_time::ptime();
+    iRetryDelay = boost::posix_time::time_duration();
+    return true;
+  }
+
+  boost::system::error_code ignored;
+  iStream.close(ignored);
+  if (iRetryDelay.total_milliseconds() == 0) {
+    iRetryDelay = boost::posix_time::milliseconds(MIN_RETRY_DELAY_MILLIS);
+  } else {
+    iRetryDelay = std::min(iRetryDelay * 2, boost::posix_time::time_duration(boost::posix_time::milliseconds(MAX_RETRY_DELAY_MILLIS)));
+  }
+  iRetryAt = boost::posix_time::microsec_clock::universal_time() + iRetryDelay;
+  return false;
+}
+
+bool FramedTcpSocket::connect() {
+  ConnectHandler handler = { &iError, &iDone, &iTimer };
+  iDone = false;
+  boost::asio::async_connect(iStream, iEndpoints, handler);
+  return runWithTimeout();
+}
+
+bool FramedTcpSocket::write(const std::string& frame) {
+  WriteHandler handler = { &iError, &iDone, &iTimer };
+  iDone = false;
+  boost::asio::async_write(iStream, boost::asio::buffer(frame), handler);
+  return runWithTimeout();
+}
+
+/*
+ * Run the operation that has just been started until it completes or the
+ * timeout expires, and return whether it succeeded.
+ */
+bool FramedTcpSocket::runWithTimeout() {
+  TimeoutHandler handler = { &iStream, &iDone };
+  iTimer.expires_from_now(boost::posix_time::milliseconds(IO_TIMEOUT_MILLIS));
+  iTimer.async_wait(handler);
+  iIOService.reset();
+  iIOService.run();
+  return iDone && !iError;
+}
@@ -0,0 +1,58 @@
+/********************************************************* {COPYRIGHT-TOP} ***
+* Copyright 2016 IBM Corporation
+*
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the MIT License
+* which accompanies this distribution, and is available at
+* http://opensource.org/licenses/MIT
+********************************************************** {COPYRIGHT-END} **/
+
+#ifndef FramedTcpSocket_hpp
+#define FramedTcpSocket_hpp
+
+#include "FrameCodec.hpp"
+#include "UdpSocket.hpp"
+
+/*
+ * Sends the batches built by UdpSocket over a TCP stream, front-coded and
+ * length-prefixed by FrameEncoder. The receiving side uses FrameDecoder (or
+ * the statsd-unframe tool) to turn the stream back into StatsD lines.
+ *
+ * Connecting and writing are bounded by a timeout, and after a failure no
+ * connection is attempted until a back-off delay has passed, so that an
+ * unreachable relay never holds up the thread that sends.
+ */
+class FramedTcpSocket : public UdpSocket {
+
+public:
+
+  FramedTcpSocket(const std::u16string& hostname, const std::u16string& port, PacketPool* pool = NULL);
+  virtual ~FramedTcpSocket();
+
+  // There is no datagram limit on a stream, so batches can be much larger
+  // than for UDP; this keeps a frame comfortably inside one TCP window.
+  static const size_t MAX_BATCH_SIZE = PacketPool::MAX_BUFFER_SIZE;
+
+protected:
+
+  virtual bool transmit(const char* packet, size_t length);
+
+  bool connect();
+  bool write(const std::string& frame);
+  bool runWithTimeout();
+
+  FrameEncoder iEncoder;
+  boost::asio::ip::tcp::resolver::iterator iEndpoints;
+  boost::asio::ip::tcp::socket iStream;
+  boost::asio::deadline_timer iTimer;
+
+  // The outcome of the asynchronous operation that runWithTimeout() waits for.
+  boost::system::error_code iError;
+  bool iDone;
+
+  boost::posix_time::ptime iRetryAt;
+  boost::posix_time::time_duration iRetryDelay;
+
+};
+
+#endif // FramedTcpSocket_hpp
@@ -0,0 +1,83 @@
+/********************************************************* {COPYRIGHT-TOP} ***
+* Copyright 2016 IBM Corporation
+*
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the MIT License
+* which accompanies this distribution, and is available at
+* http://opensource.org/licenses/MIT
+********************************************************** {COPYRIGHT-END} **/
+
+#include "PacketPool.hpp"
+
+const size_t PacketPool::CACHE_LINE_SIZE;
+const size_t PacketPool::MAX_BUFFER_SIZE;
+
+PacketPool::PacketPool(size_t memoryLimit, size_t packetSize)
+ : iMemory(NULL),
+   iBufferSize(0),
+   iFree(NULL),
+   iInUse(0),
+   iHighWater(0),
+   iExhausted(0),
+   iOversized(0) {
+  resize(memoryLimit, packetSize);
+}
+
+PacketPool::~PacketPool() {
+  delete[] iMemory;
+}
+
+bool PacketPool::resize(size_t memoryLimit, size_t packetSize) {
+  if (iInUse != 0) {
+    return false;
+  }
+  delete[] iMemory;
+  iMemory = NULL;
+  iFree = NULL;
+  iBuffers.clear();
+  iHighWater = 0;
+
+  /*
+   * The buffer size is a multiple of the cache line size, so aligning the start
+   * of the block aligns every buffer and no two buffers share a cache line.
+   */
+  iBufferSize = ((packetSize + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE) * CACHE_LINE_SIZE;
+  size_t count = (iBufferSize != 0) ? memoryLimit / iBufferSize : 0;
+  if (count == 0) {
+    return true;
+  }
+
+  iMemory = new char[(count * iBufferSize) + CACHE_LINE_SIZE];
+  uintptr_t address = reinterpret_cast<uintptr_t>(iMemory);
+  char* aligned = iMemory + ((CACHE_LINE_SIZE - (address % CACHE_LINE_SIZE)) % CACHE_LINE_SIZE);
+
+  iBuffers.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    iBuffers[i].iData = aligned + (i * iBufferSize);
+    iBuffers[i].iLength = 0;
+    iBuffers[i].iNext = (i + 1 < count) ? &iBuffers[i + 1] : NULL;
+  }
+  iFree = &iBuffers[0];
+  return true;
+}
+
+PacketBuffer* PacketPool::acquire() {
+  PacketBuffer* buffer = iFree;
+  if (buffer == NULL) {
+    ++iExhausted;
+    return NULL;
+  }
+  iFree = buffer->iNext;
+  buffer->iNext = NULL;
+  buffer->iLength = 0;
+  if (++iInUse > iHighWater) {
+    iHighWater = iInUse;
+  }
+  return buffer;
+}
+
+void PacketPool::release(PacketBuffer* buffer) {
+  buffer->iNext = iFree;
+  iFree = buffer;
+  --iInUse;
+}
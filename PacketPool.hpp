@@ -0,0 +1,81 @@
+/********************************************************* {COPYRIGHT-TOP} ***
+* Copyright 2016 IBM Corporation
+*
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the MIT License
+* which accompanies this distribution, and is available at
+* http://opensource.org/licenses/MIT
+********************************************************** {COPYRIGHT-END} **/
+
+#ifndef PacketPool_hpp
+#define PacketPool_hpp
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/*
+ * A fixed size buffer that one packet is batched into before it is sent.
+ */
+struct PacketBuffer {
+  char* iData;
+  size_t iLength;
+  PacketBuffer* iNext;
+};
+
+/*
+ * A fixed set of packet buffers carved from one cache-line aligned block,
+ * recycled through an intrusive free list. The buffers are sized for the
+ * largest packet of the transport in use (rounded up to whole cache lines),
+ * so the memory limit translates directly into a number of packets. Nothing
+ * is allocated after construction or resize(), so the memory used for packets
+ * is bounded by the limit it was given. When every buffer is in use, acquire() returns NULL
+ * and the caller drops the data, which is counted as an exhaustion.
+ *
+ * The pool is not thread safe; it is only used from the thread that calls
+ * StatsdStatsWriter::write().
+ */
+class PacketPool {
+
+public:
+
+  PacketPool(size_t memoryLimit, size_t packetSize);
+  ~PacketPool();
+
+  // Reallocate for a new memory limit or packet size; fails if any buffer is in use.
+  bool resize(size_t memoryLimit, size_t packetSize);
+
+  PacketBuffer* acquire();
+  void release(PacketBuffer* buffer);
+
+  size_t bufferSize() const { return iBufferSize; }
+  size_t bufferCount() const { return iBuffers.size(); }
+  size_t inUse() const { return iInUse; }
+  size_t highWater() const { return iHighWater; }
+  uint64_t exhausted() const { return iExhausted; }
+
+  // Count data that was dropped because it is longer than a buffer.
+  void dropOversized() { ++iOversized; }
+  uint64_t oversized() const { return iOversized; }
+
+  static const size_t CACHE_LINE_SIZE = 64;
+  // The largest packet size of any transport.
+  static const size_t MAX_BUFFER_SIZE = 8192;
+
+private:
+
+  PacketPool(const PacketPool&);
+  PacketPool& operator=(const PacketPool&);
+
+  char* iMemory;
+  size_t iBufferSize;
+  std::vector<PacketBuffer> iBuffers;
+  PacketBuffer* iFree;
+  size_t iInUse;
+  size_t iHighWater;
+  uint64_t iExhausted;
+  uint64_t iOversized;
+
+};
+
+#endif // PacketPool_hpp
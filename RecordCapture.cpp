@@ -0,0 +1,267 @@
+/********************************************************* {COPYRIGHT-TOP} ***
+* Copyright 2016 IBM Corporation
+*
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the MIT License
+* which accompanies this distribution, and is available at
+* http://opensource.org/licenses/MIT
+********************************************************** {COPYRIGHT-END} **/
+
+#include "RecordCapture.hpp"
+
+#include <boost/locale.hpp>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+using boost::locale::conv::utf_to_utf;
+
+namespace {
+
+  /*
+   * Every session starts with this; the first byte doubles as the entry tag.
+   */
+  const char SESSION_MAGIC[] = { '\x89', 'S', 'D', 'S', 'W', 'C', 'A', 'P' };
+  const char STRING_TAG = 'S';
+  const char RECORD_TAG = 'R';
+
+  void appendVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+      out += static_cast<char>((value & 0x7F) | 0x80);
+      value >>= 7;
+    }
+    out += static_cast<char>(value);
+  }
+
+  /*
+   * Zigzag encoding keeps small negative numbers small.
+   */
+  void appendSigned(std::string& out, int64_t value) {
+    appendVarint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+  }
+
+  void appendReal(std::string& out, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    for (int i = 0; i < 8; ++i) {
+      out += static_cast<char>((bits >> (i * 8)) & 0xFF);
+    }
+  }
+
+  void appendDateTime(std::string& out, const CciDate& date, const CciTime& time) {
+    appendSigned(out, date.year);
+    appendSigned(out, date.month);
+    appendSigned(out, date.day);
+    appendSigned(out, time.hour);
+    appendSigned(out, time.minute);
+    appendReal(out, time.second);
+  }
+
+  int readByte(std::FILE* file) {
+    int byte = std::fgetc(file);
+    if (byte == EOF) {
+      throw std::runtime_error("Truncated capture file");
+    }
+    return byte;
+  }
+
+  uint64_t readVarint(std::FILE* file) {
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      int byte = readByte(file);
+      value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+      if ((byte & 0x80) == 0) {
+        return value;
+      }
+    }
+    throw std::runtime_error("Corrupt varint in capture file");
+  }
+
+  template <class T>
+  void readSigned(std::FILE* file, T& field) {
+    uint64_t value = readVarint(file);
+    field = static_cast<T>(static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1));
+  }
+
+  template <class T>
+  void readReal(std::FILE* file, T& field) {
+    uint64_t bits = 0;
+    for (int i = 0; i < 8; ++i) {
+      bits |= static_cast<uint64_t>(readByte(file)) << (i * 8);
+    }
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    field = static_cast<T>(value);
+  }
+
+  void readDateTime(std::FILE* file, CciDate& date, CciTime& time) {
+    readSigned(file, date.year);
+    readSigned(file, date.month);
+    readSigned(file, date.day);
+    readSigned(file, time.hour);
+    readSigned(file, time.minute);
+    readReal(file, time.second);
+  }
+
+}
+
+CaptureWriter::CaptureWriter(const std::string& path)
+ : iFile(std::fopen(path.c_str(), "ab")),
+   iError(0) {
+  if (iFile == NULL) {
+    iError = errno;
+  } else if (std::fwrite(SESSION_MAGIC, sizeof(SESSION_MAGIC), 1, iFile) != 1) {
+    iError = errno;
+    std::fclose(iFile);
+    iFile = NULL;
+  }
+}
+
+CaptureWriter::~CaptureWriter() {
+  if (iFile != NULL) {
+    std::fclose(iFile);
+  }
+}
+
+/*
+ * Append one record. Any new strings are defined immediately before the record
+ * that first uses them, and the entry is flushed so that a capture is usable
+ * even if the integration server is stopped abruptly.
+ */
+bool CaptureWriter::write(const CsiStatsRecord* record, uint64_t elapsedMillis) {
+  if (iFile == NULL) {
+    return false;
+  }
+  const CsiStatsRecordMessageFlow& flow = record->messageFlow;
+  const CciChar* strings[] = {
+    flow.brokerLabel, flow.brokerUUID, flow.executionGroupName, flow.executionGroupUUID,
+    flow.messageFlowName, flow.messageFlowUUID, flow.applicationName, flow.applicationUUID,
+    flow.libraryName, flow.libraryUUID, flow.accountingOrigin
+  };
+  uint64_t ids[sizeof(strings) / sizeof(strings[0])];
+
+  iEntry.clear();
+  for (size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); ++i) {
+    ids[i] = intern(strings[i]);
+  }
+
+  iEntry += RECORD_TAG;
+  appendVarint(iEntry, elapsedMillis);
+  appendSigned(iEntry, record->version);
+  appendSigned(iEntry, record->type);
+  appendSigned(iEntry, record->code);
+  for (size_t i = 0; i < sizeof(ids) / sizeof(ids[0]); ++i) {
+    appendVarint(iEntry, ids[i]);
+  }
+  appendDateTime(iEntry, flow.startDate, flow.startTime);
+  appendDateTime(iEntry, flow.endDate, flow.endTime);
+  appendSigned(iEntry, flow.totalElapsedTime);
+  appendSigned(iEntry, flow.maximumElapsedTime);
+  appendSigned(iEntry, flow.minimumElapsedTime);
+  appendSigned(iEntry, flow.totalCPUTime);
+  appendSigned(iEntry, flow.maximumCPUTime);
+  appendSigned(iEntry, flow.minimumCPUTime);
+  appendSigned(iEntry, flow.totalInputMessages);
+
+  if (std::fwrite(iEntry.data(), iEntry.length(), 1, iFile) != 1 || std::fflush(iFile) != 0) {
+    iError = errno;
+    std::fclose(iFile);
+    iFile = NULL;
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Return the id of the specified string, adding a string definition to the
+ * current entry the first time it is seen in this session.
+ */
+uint64_t CaptureWriter::intern(const CciChar* value) {
+  if (value == NULL) {
+    return 0;
+  }
+  std::u16string key(value);
+  std::map<std::u16string, uint64_t>::const_iterator found = iStrings.find(key);
+  if (found != iStrings.end()) {
+    return found->second;
+  }
+  std::string utf8(utf_to_utf<char>(key));
+  iEntry += STRING_TAG;
+  appendVarint(iEntry, utf8.length());
+  iEntry += utf8;
+  uint64_t id = iStrings.size() + 1;
+  iStrings.insert(std::make_pair(key, id));
+  return id;
+}
+
+CaptureReader::CaptureReader(const std::string& path)
+ : iFile(std::fopen(path.c_str(), "rb")) {
+  if (iFile == NULL) {
+    throw std::runtime_error("Cannot open capture file " + path);
+  }
+}
+
+CaptureReader::~CaptureReader() {
+  std::fclose(iFile);
+}
+
+bool CaptureReader::next(CsiStatsRecord& record, uint64_t& elapsedMillis) {
+  for (;;) {
+    int tag = std::fgetc(iFile);
+    if (tag == EOF) {
+      return false;
+    }
+    if (tag == static_cast<unsigned char>(SESSION_MAGIC[0])) {
+      char magic[sizeof(SESSION_MAGIC) - 1];
+      if (std::fread(magic, sizeof(magic), 1, iFile) != 1 || memcmp(magic, SESSION_MAGIC + 1, sizeof(magic)) != 0) {
+        throw std::runtime_error("Bad session header in capture file");
+      }
+      iStrings.clear();
+    } else if (tag == STRING_TAG) {
+      std::string utf8(static_cast<size_t>(readVarint(iFile)), '\0');
+      if (!utf8.empty() && std::fread(&utf8[0], utf8.length(), 1, iFile) != 1) {
+        throw std::runtime_error("Truncated capture file");
+      }
+      iStrings.push_back(utf_to_utf<char16_t>(utf8));
+    } else if (tag == RECORD_TAG) {
+      break;
+    } else {
+      throw std::runtime_error("Unknown entry in capture file");
+    }
+  }
+
+  memset(&record, 0, sizeof(record));
+  CsiStatsRecordMessageFlow& flow = record.messageFlow;
+  elapsedMillis = readVarint(iFile);
+  readSigned(iFile, record.version);
+  readSigned(iFile, record.type);
+  readSigned(iFile, record.code);
+  const CciChar** strings[] = {
+    &flow.brokerLabel, &flow.brokerUUID, &flow.executionGroupName, &flow.executionGroupUUID,
+    &flow.messageFlowName, &flow.messageFlowUUID, &flow.applicationName, &flow.applicationUUID,
+    &flow.libraryName, &flow.libraryUUID, &flow.accountingOrigin
+  };
+  for (size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); ++i) {
+    *strings[i] = lookup(readVarint(iFile));
+  }
+  readDateTime(iFile, flow.startDate, flow.startTime);
+  readDateTime(iFile, flow.endDate, flow.endTime);
+  readSigned(iFile, flow.totalElapsedTime);
+  readSigned(iFile, flow.maximumElapsedTime);
+  readSigned(iFile, flow.minimumElapsedTime);
+  readSigned(iFile, flow.totalCPUTime);
+  readSigned(iFile, flow.maximumCPUTime);
+  readSigned(iFile, flow.minimumCPUTime);
+  readSigned(iFile, flow.totalInputMessages);
+  return true;
+}
+
+const CciChar* CaptureReader::lookup(uint64_t id) const {
+  if (id == 0) {
+    return NULL;
+  }
+  if (id > iStrings.size()) {
+    throw std::runtime_error("Undefined string in capture file");
+  }
+  return iStrings[static_cast<size_t>(id - 1)].c_str();
+}
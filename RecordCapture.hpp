@@ -0,0 +1,89 @@
+/********************************************************* {COPYRIGHT-TOP} ***
+* Copyright 2016 IBM Corporation
+*
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the MIT License
+* which accompanies this distribution, and is available at
+* http://opensource.org/licenses/MIT
+********************************************************** {COPYRIGHT-END} **/
+
+#ifndef RecordCapture_hpp
+#define RecordCapture_hpp
+
+#include <BipCsi.h>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <string>
+
+#if defined(AVOID_CXX11)
+# include "Compat.hpp"
+#endif
+
+/*
+ * Capture files hold the statistics records passed to StatsdStatsWriter::write(),
+ * so that a production load can be replayed through the writer later. A file is
+ * a sequence of sessions, one per time capture was switched on, each starting
+ * with an 8 byte magic number. Within a session:
+ *
+ *   'S' varint length, UTF-8 bytes       defines the next string id (from 1)
+ *   'R' varint elapsedMillis, fields...  a record; names are string ids, 0 is NULL
+ *
+ * Flow and node names repeat in every record, so each is written only once per
+ * session. Only the parts of the record that the writer uses are captured.
+ */
+class CaptureWriter {
+
+public:
+
+  // Appends a new session to the file; check good() for success.
+  explicit CaptureWriter(const std::string& path);
+  ~CaptureWriter();
+
+  bool good() const { return iFile != NULL; }
+
+  // The errno of the failure that closed the file, if any.
+  int error() const { return iError; }
+
+  // Returns false, and closes the file, if the record cannot be written.
+  bool write(const CsiStatsRecord* record, uint64_t elapsedMillis);
+
+private:
+
+  CaptureWriter(const CaptureWriter&);
+  CaptureWriter& operator=(const CaptureWriter&);
+
+  std::FILE* iFile;
+  int iError;
+  std::map<std::u16string, uint64_t> iStrings;
+  std::string iEntry;
+
+  uint64_t intern(const CciChar* value);
+
+};
+
+class CaptureReader {
+
+public:
+
+  // Throws std::runtime_error if the file cannot be opened.
+  explicit CaptureReader(const std::string& path);
+  ~CaptureReader();
+
+  // Returns false at the end of the file. Strings in the record remain valid
+  // until the next call. Throws std::runtime_error if the file is corrupt.
+  bool next(CsiStatsRecord& record, uint64_t& elapsedMillis);
+
+private:
+
+  CaptureReader(const CaptureReader&);
+  CaptureReader& operator=(const CaptureReader&);
+
+  std::FILE* iFile;
+  std::deque<std::u16string> iStrings;
+
+  const CciChar* lookup(uint64_t id) const;
+
+};
+
+#endif // RecordCapture_hpp
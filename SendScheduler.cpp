@@ -0,0 +1,386 @@
+/********************************************************* {COPYRIGHT-TOP} ***
+* Copyright 2016 IBM Corporation
+*
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the MIT License
+* which accompanies this distribution, and is available at
+* http://opensource.org/licenses/MIT
+********************************************************** {COPYRIGHT-END} **/
+
+#include "SendScheduler.hpp"
+#include "UdpSocket.hpp"
+
+#include <algorithm>
+
+namespace {
+
+  /*
+   * Step over one UTF-8 character.
+   */
+  size_t nextCharacter(const char* text, size_t length, size_t offset) {
+    ++offset;
+    while (offset < length && (static_cast<unsigned char>(text[offset]) & 0xC0) == 0x80) {
+      ++offset;
+    }
+    return offset;
+  }
+
+}
+
+/*
+ * Match greedily, going back to the last '*' to let it take one more
+ * character whenever the rest of the pattern fails to match.
+ */
+bool SendScheduler::matchesPattern(const std::string& pattern, const char* name, size_t length) {
+  size_t p = 0, n = 0;
+  size_t star = std::string::npos, resume = 0;
+  while (n < length) {
+    if (p < pattern.length() && pattern[p] == '*') {
+      star = p++;
+      resume = n;
+    } else if (p < pattern.length() && pattern[p] == '?') {
+      ++p;
+      n = nextCharacter(name, length, n);
+    } else if (p < pattern.length() && pattern[p] == name[n]) {
+      ++p;
+      ++n;
+    } else if (star != std::string::npos) {
+      p = star + 1;
+      resume = nextCharacter(name, length, resume);
+      n = resume;
+    } else {
+      return false;
+    }
+  }
+  while (p < pattern.length() && pattern[p] == '*') {
+    ++p;
+  }
+  return p == pattern.length();
+}
+
+/*
+ * An FNV-1a hash of the name, reduced to the window.
+ */
+uint32_t SendScheduler::jitterOffset(const char* name, size_t length, uint32_t jitterMillis) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; ++i) {
+    hash = (hash ^ static_cast<unsigned char>(name[i])) * 16777619u;
+  }
+  return hash % jitterMillis;
+}
+
+#if defined(AVOID_CXX11)
+
+/*
+ * Without C++11 threads there is no pacing; sockets send directly.
+ */
+SendScheduler::SendScheduler()
+ : iRunning(false),
+   iShed(0),
+   iFailed(0) {
+}
+
+SendScheduler::~SendScheduler() {
+}
+
+bool SendScheduler::supported() { return false; }
+void SendScheduler::configure(uint64_t packetsPerSecond, uint64_t bytesPerSecond, uint32_t jitterMillis) {}
+void SendScheduler::submit(UdpSocket* socket, PacketBuffer* packet, bool critical, uint32_t delayMillis) {
+  if (!socket->transmit(packet->iData, packet->iLength)) {
+    ++iFailed;
+  }
+  socket->iPool->release(packet);
+}
+void SendScheduler::drain(UdpSocket* socket) {}
+void SendScheduler::reclaim() {}
+bool SendScheduler::shed(PacketPool* pool, bool critical) { return false; }
+void SendScheduler::transmitFailed() { ++iFailed; }
+uint64_t SendScheduler::deferred() const { return 0; }
+uint64_t SendScheduler::shedCount() const { return 0; }
+uint64_t SendScheduler::failedCount() const { return iFailed; }
+
+#else
+
+namespace {
+
+  /*
+   * The bucket holds a tenth of a second of budget, which allows short bursts
+   * while still spreading a whole interval's records out.
+   */
+  const double BURST_SECONDS = 0.1;
+
+}
+
+SendScheduler::SendScheduler()
+ : iRunning(false),
+   iShed(0),
+   iFailed(0),
+   iStopping(false),
+   iInFlight(NULL),
+   iPacketRate(0),
+   iByteRate(0),
+   iPacketTokens(0),
+   iByteTokens(0),
+   iDeferred(0) {
+}
+
+/*
+ * Queued packets are discarded, as with anything a socket has batched when it
+ * is destroyed.
+ */
+SendScheduler::~SendScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(iMutex);
+    iStopping = true;
+  }
+  iWake.notify_all();
+  if (iThread.joinable()) {
+    iThread.join();
+  }
+  for (size_t i = 0; i < iCritical.size(); ++i) {
+    iCritical[i].iPool->release(iCritical[i].iPacket);
+  }
+  for (std::multimap<Clock::time_point, Entry>::iterator it = iNormal.begin(); it != iNormal.end(); ++it) {
+    it->second.iPool->release(it->second.iPacket);
+  }
+  reclaim();
+}
+
+bool SendScheduler::supported() {
+  return true;
+}
+
+void SendScheduler::configure(uint64_t packetsPerSecond, uint64_t bytesPerSecond, uint32_t jitterMillis) {
+  {
+    std::lock_guard<std::mutex> lock(iMutex);
+    iPacketRate = static_cast<double>(packetsPerSecond);
+    iByteRate = static_cast<double>(bytesPerSecond);
+    iPacketTokens = 0;
+    iByteTokens = 0;
+    iRefilled = Clock::now() - std::chrono::milliseconds(static_cast<int>(BURST_SECONDS * 1000));
+  }
+  iWake.notify_all();
+
+  /*
+   * Once started, the thread keeps running even if pacing is switched off
+   * again, so that packets already queued are never sent concurrently with
+   * new ones from the write() thread.
+   */
+  if (!iRunning && (packetsPerSecond != 0 || bytesPerSecond != 0 || jitterMillis != 0)) {
+    iThread = std::thread(&SendScheduler::run, this);
+    iRunning = true;
+  }
+}
+
+void SendScheduler::submit(UdpSocket* socket, PacketBuffer* packet, bool critical, uint32_t delayMillis) {
+  Entry entry = { socket, socket->iPool, packet, false };
+  {
+    std::lock_guard<std::mutex> lock(iMutex);
+    if (critical) {
+      iCritical.push_back(entry);
+    } else {
+      iNormal.insert(std::make_pair(Clock::now() + std::chrono::milliseconds(delayMillis), entry));
+    }
+  }
+  iWake.notify_all();
+}
+
+/*
+ * Waits for a send to the socket that the thread has in flight, so that the
+ * socket, and the pool it may own, can be destroyed once this returns. The packets are then taken off
+ * the queues and sent without the lock held; only write() submits packets, so
+ * no more can be queued for the socket meanwhile.
+ */
+void SendScheduler::drain(UdpSocket* socket) {
+  std::vector<Entry> entries;
+  std::unique_lock<std::mutex> lock(iMutex);
+  while (iInFlight != NULL && (socket == NULL || iInFlight == socket)) {
+    iIdle.wait(lock);
+  }
+  std::deque<Entry>::iterator critical = iCritical.begin();
+  while (critical != iCritical.end()) {
+    if (socket == NULL || critical->iSocket == socket) {
+      entries.push_back(*critical);
+      critical = iCritical.erase(critical);
+    } else {
+      ++critical;
+    }
+  }
+  std::multimap<Clock::time_point, Entry>::iterator normal = iNormal.begin();
+  while (normal != iNormal.end()) {
+    if (socket == NULL || normal->second.iSocket == socket) {
+      entries.push_back(normal->second);
+      iNormal.erase(normal++);
+    } else {
+      ++normal;
+    }
+  }
+  if (!entries.empty()) {
+    lock.unlock();
+    uint64_t failed = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+      if (!entries[i].iSocket->transmit(entries[i].iPacket->iData, entries[i].iPacket->iLength)) {
+        ++failed;
+      }
+    }
+    lock.lock();
+    iFailed += failed;
+    iSent.insert(iSent.end(), entries.begin(), entries.end());
+  }
+  for (size_t i = 0; i < iSent.size(); ++i) {
+    iSent[i].iPool->release(iSent[i].iPacket);
+  }
+  iSent.clear();
+}
+
+void SendScheduler::reclaim() {
+  std::lock_guard<std::mutex> lock(iMutex);
+  for (size_t i = 0; i < iSent.size(); ++i) {
+    iSent[i].iPool->release(iSent[i].iPacket);
+  }
+  iSent.clear();
+}
+
+/*
+ * Only a packet from the same pool frees a buffer that the caller can use.
+ */
+bool SendScheduler::shed(PacketPool* pool, bool critical) {
+  std::lock_guard<std::mutex> lock(iMutex);
+  std::multimap<Clock::time_point, Entry>::iterator normal = iNormal.begin();
+  while (normal != iNormal.end() && normal->second.iPool != pool) {
+    ++normal;
+  }
+  std::deque<Entry>::iterator first = iCritical.begin();
+  while (critical && first != iCritical.end() && first->iPool != pool) {
+    ++first;
+  }
+  PacketBuffer* packet = NULL;
+  if (normal != iNormal.end()) {
+    packet = normal->second.iPacket;
+    iNormal.erase(normal);
+  } else if (critical && first != iCritical.end()) {
+    packet = first->iPacket;
+    iCritical.erase(first);
+  } else {
+    return false;
+  }
+  pool->release(packet);
+  ++iShed;
+  return true;
+}
+
+uint64_t SendScheduler::deferred() const {
+  std::lock_guard<std::mutex> lock(iMutex);
+  return iDeferred;
+}
+
+uint64_t SendScheduler::shedCount() const {
+  std::lock_guard<std::mutex> lock(iMutex);
+  return iShed;
+}
+
+void SendScheduler::transmitFailed() {
+  std::lock_guard<std::mutex> lock(iMutex);
+  ++iFailed;
+}
+
+uint64_t SendScheduler::failedCount() const {
+  std::lock_guard<std::mutex> lock(iMutex);
+  return iFailed;
+}
+
+/*
+ * The sending thread. Critical packets go first; other packets wait for their
+ * due time. Either kind waits for the budget, and is counted as deferred the
+ * first time it has to. The packet is taken off its queue before it is sent
+ * without the lock, so that write() is never held up by a slow send.
+ */
+void SendScheduler::run() {
+  std::unique_lock<std::mutex> lock(iMutex);
+  while (!iStopping) {
+    Clock::time_point now = Clock::now();
+    Entry* entry = NULL;
+    bool critical = !iCritical.empty();
+    if (critical) {
+      entry = &iCritical.front();
+    } else if (!iNormal.empty() && iNormal.begin()->first <= now) {
+      entry = &iNormal.begin()->second;
+    }
+    if (entry == NULL) {
+      if (iNormal.empty()) {
+        iWake.wait(lock);
+      } else {
+        iWake.wait_until(lock, iNormal.begin()->first);
+      }
+      continue;
+    }
+
+    refill(now);
+    Clock::duration wait = budgetWait(entry->iPacket->iLength);
+    if (wait > Clock::duration::zero()) {
+      if (!entry->iDeferred) {
+        entry->iDeferred = true;
+        ++iDeferred;
+      }
+      iWake.wait_for(lock, wait);
+      continue;
+    }
+    iPacketTokens -= 1;
+    iByteTokens -= static_cast<double>(entry->iPacket->iLength);
+
+    Entry sending = *entry;
+    if (critical) {
+      iCritical.pop_front();
+    } else {
+      iNormal.erase(iNormal.begin());
+    }
+    transmit(lock, sending);
+  }
+}
+
+void SendScheduler::refill(Clock::time_point now) {
+  double seconds = std::chrono::duration<double>(now - iRefilled).count();
+  iRefilled = now;
+  if (iPacketRate > 0) {
+    double capacity = std::max(1.0, iPacketRate * BURST_SECONDS);
+    iPacketTokens = std::min(capacity, iPacketTokens + (seconds * iPacketRate));
+  }
+  if (iByteRate > 0) {
+    double capacity = std::max(static_cast<double>(PacketPool::MAX_BUFFER_SIZE), iByteRate * BURST_SECONDS);
+    iByteTokens = std::min(capacity, iByteTokens + (seconds * iByteRate));
+  }
+}
+
+/*
+ * How long until the budget allows a packet of the specified length; zero if
+ * it can be sent now. Unlimited rates never wait.
+ */
+SendScheduler::Clock::duration SendScheduler::budgetWait(size_t length) const {
+  double seconds = 0;
+  if (iPacketRate > 0 && iPacketTokens < 1) {
+    seconds = std::max(seconds, (1 - iPacketTokens) / iPacketRate);
+  }
+  if (iByteRate > 0 && iByteTokens < static_cast<double>(length)) {
+    seconds = std::max(seconds, (static_cast<double>(length) - iByteTokens) / iByteRate);
+  }
+  return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+}
+
+/*
+ * Send a packet that is no longer queued. The lock is released while sending
+ * and held again on return; iInFlight tells drain() which socket is in use.
+ */
+void SendScheduler::transmit(std::unique_lock<std::mutex>& lock, const Entry& entry) {
+  iInFlight = entry.iSocket;
+  lock.unlock();
+  bool sent = entry.iSocket->transmit(entry.iPacket->iData, entry.iPacket->iLength);
+  lock.lock();
+  iInFlight = NULL;
+  if (!sent) {
+    ++iFailed;
+  }
+  iSent.push_back(entry);
+  iIdle.notify_all();
+}
+
+#endif
@@ -0,0 +1,136 @@
+/********************************************************* {COPYRIGHT-TOP} ***
+* Copyright 2016 IBM Corporation
+*
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the MIT License
+* which accompanies this distribution, and is available at
+* http://opensource.org/licenses/MIT
+********************************************************** {COPYRIGHT-END} **/
+
+#ifndef SendScheduler_hpp
+#define SendScheduler_hpp
+
+#include "PacketPool.hpp"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#if !defined(AVOID_CXX11)
+# include <chrono>
+# include <condition_variable>
+# include <map>
+# include <mutex>
+# include <thread>
+#endif
+
+class UdpSocket;
+
+/*
+ * Paces the packets flushed by the sockets, so that the burst of records the
+ * integration server writes at each interval does not overflow the receiver.
+ * Packets are sent from a background thread within a token bucket budget of
+ * packets and bytes per second. Packets for critical flows are sent first and
+ * are never delayed by jitter; other packets are held until their due time,
+ * which the writer spreads across the interval per flow.
+ *
+ * Packet buffers stay owned by the pool of the socket that flushed them, which
+ * need not be the writer's pool. Sent and shed buffers are only given back to
+ * their pool by reclaim(), drain() and shed(), which are called on the thread
+ * that calls StatsdStatsWriter::write(), so the pools need no locking.
+ *
+ * The background thread needs C++11; when built with AVOID_CXX11, supported()
+ * is false and every packet is sent immediately by its socket.
+ */
+class SendScheduler {
+
+public:
+
+  SendScheduler();
+  ~SendScheduler();
+
+  static bool supported();
+
+  // A limit of 0 means unlimited. The thread starts when pacing is first needed.
+  void configure(uint64_t packetsPerSecond, uint64_t bytesPerSecond, uint32_t jitterMillis);
+
+  // True once packets must go through submit() rather than being sent directly.
+  bool running() const { return iRunning; }
+
+  // Takes ownership of the packet until it is sent or shed.
+  void submit(UdpSocket* socket, PacketBuffer* packet, bool critical, uint32_t delayMillis);
+
+  // Send everything queued for the socket (or for every socket if NULL) now,
+  // regardless of the budget, and give back every sent buffer; used before a
+  // socket or the pool is replaced.
+  void drain(UdpSocket* socket);
+
+  void reclaim();
+
+  // Drop the oldest queued packet from the pool to free a buffer for a new one.
+  // Critical packets are only dropped to make room for another critical packet.
+  bool shed(PacketPool* pool, bool critical);
+
+  // Count a packet that a socket failed to send itself.
+  void transmitFailed();
+
+  uint64_t deferred() const;
+  uint64_t shedCount() const;
+  uint64_t failedCount() const;
+
+  // Whether a unique flow name, in UTF-8, matches a critical flow pattern, in
+  // which '*' matches any run of characters and '?' any one character.
+  static bool matchesPattern(const std::string& pattern, const char* name, size_t length);
+
+  // A stable delay for the flow within the jitter window, so that each flow
+  // keeps the same phase from one interval to the next.
+  static uint32_t jitterOffset(const char* name, size_t length, uint32_t jitterMillis);
+
+private:
+
+  SendScheduler(const SendScheduler&);
+  SendScheduler& operator=(const SendScheduler&);
+
+  struct Entry {
+    UdpSocket* iSocket;
+    PacketPool* iPool;
+    PacketBuffer* iPacket;
+    bool iDeferred;
+  };
+
+  bool iRunning;
+  uint64_t iShed;
+  uint64_t iFailed;
+  std::vector<Entry> iSent;
+
+#if !defined(AVOID_CXX11)
+  typedef std::chrono::steady_clock Clock;
+
+  mutable std::mutex iMutex;
+  std::condition_variable iWake;
+  std::thread iThread;
+  bool iStopping;
+
+  // The socket the thread is sending to, if any, and notified when it is done.
+  UdpSocket* iInFlight;
+  std::condition_variable iIdle;
+
+  std::deque<Entry> iCritical;
+  std::multimap<Clock::time_point, Entry> iNormal;
+
+  double iPacketRate;
+  double iByteRate;
+  double iPacketTokens;
+  double iByteTokens;
+  Clock::time_point iRefilled;
+  uint64_t iDeferred;
+
+  void run();
+  void refill(Clock::time_point now);
+  Clock::duration budgetWait(size_t length) const;
+  void transmit(std::unique_lock<std::mutex>& lock, const Entry& entry);
+#endif
+
+};
+
+#endif // SendScheduler_hpp
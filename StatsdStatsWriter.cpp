@@ -8,14 +8,20 @@
 ********************************************************** {COPYRIGHT-END} **/
 
 #include "StatsdStatsWriter.hpp"
+#include "FramedTcpSocket.hpp"
+#include "RecordCapture.hpp"
 #include "UdpSocket.hpp"
 
 #include <algorithm>
 #include <boost/asio/ip/host_name.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/locale.hpp>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <exception>
+#include <vector>
 
 using namespace boost::asio::ip;
 using boost::locale::conv::utf_to_utf;
@@ -106,21 +112,469 @@ namespace {
    */
   const std::u16string PORT_NAME(u"port");
 
+  /*
+   * This is the name of a property of this statistics writer. It selects how
+   * metrics are sent: "udp" (the default) sends plain StatsD datagrams, and
+   * "tcp-framed" sends compact length-prefixed frames over TCP to a relay
+   * that decodes them with statsd-unframe.
+   */
+  const std::u16string PROTOCOL_NAME(u"protocol");
+
+  const std::u16string UDP_PROTOCOL(u"udp");
+  const std::u16string TCP_FRAMED_PROTOCOL(u"tcp-framed");
+
+  /*
+   * These are the names of properties that send archive records to a different
+   * StatsD server from snapshot records. If archiveHostname is not set, then
+   * archive records are sent to the same server as snapshot records. If
+   * archivePort is not set, then the port property is used.
+   */
+  const std::u16string ARCHIVE_HOSTNAME_NAME(u"archiveHostname");
+  const std::u16string ARCHIVE_PORT_NAME(u"archivePort");
+
+  /*
+   * The range of the delay before trying again to resolve a destination, which
+   * doubles with each consecutive failure.
+   */
+  const long MIN_RETRY_DELAY_SECONDS = 1;
+  const long MAX_RETRY_DELAY_SECONDS = 300;
+
+  /*
+   * These are the names of properties that prefix the metric names for snapshot
+   * and archive records, so that the two streams do not overwrite each other.
+   * Snapshot metrics have no prefix by default, and archive metrics are prefixed
+   * with "archive".
+   */
+  const std::u16string SNAPSHOT_NAMESPACE_NAME(u"snapshotNamespace");
+  const std::u16string ARCHIVE_NAMESPACE_NAME(u"archiveNamespace");
+
+  /*
+   * These are the names of properties that select which metrics are written for
+   * snapshot and archive records, as a comma separated list of metric names. An
+   * empty value writes all metrics, and "none" writes nothing for that record type.
+   */
+  const std::u16string SNAPSHOT_METRICS_NAME(u"snapshotMetrics");
+  const std::u16string ARCHIVE_METRICS_NAME(u"archiveMetrics");
+
+  const std::u16string NO_METRICS(u"none");
+
+  /*
+   * This is the name of a property that limits the memory, in bytes, used to
+   * batch packets. The memory is divided into fixed size packet buffers that
+   * are allocated once; if all of them are in use, then metrics are dropped
+   * rather than allocating more memory.
+   */
+  const std::u16string MEMORY_LIMIT_NAME(u"memoryLimit");
+
+  // Enough for one interval's UDP packets from about 2000 flows to wait for a
+  // paced send.
+  const uint64_t DEFAULT_MEMORY_LIMIT = 1024 * 1024;
+  const uint64_t MAXIMUM_MEMORY_LIMIT = 64 * 1024 * 1024;
+
+  /*
+   * This is the name of a property that, when set to a file path, appends every
+   * statistics record written to the file, so that the load can be reproduced
+   * later with the statsd-replay tool. Records are captured whether or not a
+   * StatsD server is configured. An empty value switches capture off.
+   */
+  const std::u16string CAPTURE_FILE_NAME(u"captureFile");
+
+  /*
+   * These are the names of properties that pace the packets sent, so that the
+   * records written at each interval do not arrive at StatsD as one burst.
+   * sendPacketRate and sendByteRate are token bucket limits per second, and
+   * sendJitter spreads each flow's packets by a fixed offset of up to that many
+   * milliseconds. Flows whose unique flow name (application.library.flow)
+   * matches one of the comma separated patterns in criticalFlows, where '*'
+   * matches any characters and '?' any one character, are sent first and
+   * without jitter. A value of 0 switches a limit off.
+   */
+  const std::u16string SEND_PACKET_RATE_NAME(u"sendPacketRate");
+  const std::u16string SEND_BYTE_RATE_NAME(u"sendByteRate");
+  const std::u16string SEND_JITTER_NAME(u"sendJitter");
+  const std::u16string CRITICAL_FLOWS_NAME(u"criticalFlows");
+
+  const uint64_t MAXIMUM_SEND_RATE = 1000000000;
+  const uint64_t MAXIMUM_SEND_JITTER = 60000;
+
+  /*
+   * These are the names of read-only properties that report the number of
+   * packets that had to wait for the send budget, the number that were
+   * dropped because no packet buffer was free, and the number that could not
+   * be sent.
+   */
+  const std::u16string SEND_DEFERRED_NAME(u"sendDeferred");
+  const std::u16string SEND_SHED_NAME(u"sendShed");
+  const std::u16string SEND_FAILED_NAME(u"sendFailed");
+
+  /*
+   * These are the names of read-only properties that report the usage of the
+   * packet buffers: the number of buffers, the number currently in use, the
+   * most ever in use at once, the number of times a buffer was needed but
+   * none was available, and the number of metrics dropped because they were
+   * longer than a buffer.
+   */
+  const std::u16string PACKET_BUFFERS_NAME(u"packetBuffers");
+  const std::u16string PACKET_BUFFERS_IN_USE_NAME(u"packetBuffersInUse");
+  const std::u16string PACKET_BUFFERS_HIGH_WATER_NAME(u"packetBuffersHighWater");
+  const std::u16string PACKET_BUFFERS_EXHAUSTED_NAME(u"packetBuffersExhausted");
+  const std::u16string PACKET_BUFFERS_OVERSIZED_NAME(u"packetBuffersOversized");
+
+  /*
+   * The metrics written for each message flow, as bits in a metric set.
+   */
+  enum Metric {
+    MINIMUM_CPU_TIME                 = 1 << 0,
+    MAXIMUM_CPU_TIME                 = 1 << 1,
+    MINIMUM_ELAPSED_TIME             = 1 << 2,
+    MAXIMUM_ELAPSED_TIME             = 1 << 3,
+    AVERAGE_MESSAGE_RATE             = 1 << 4,
+    AVERAGE_CPU_TIME_PER_MESSAGE     = 1 << 5,
+    AVERAGE_ELAPSED_TIME_PER_MESSAGE = 1 << 6,
+    ALL_METRICS                      = (1 << 7) - 1
+  };
+
+  struct MetricName {
+    const char16_t* name;
+    Metric metric;
+  };
+
+  const MetricName METRIC_NAMES[] = {
+    { u"minimumCPUTime", MINIMUM_CPU_TIME },
+    { u"maximumCPUTime", MAXIMUM_CPU_TIME },
+    { u"minimumElapsedTime", MINIMUM_ELAPSED_TIME },
+    { u"maximumElapsedTime", MAXIMUM_ELAPSED_TIME },
+    { u"averageMessageRate", AVERAGE_MESSAGE_RATE },
+    { u"averageCPUTimePerMessage", AVERAGE_CPU_TIME_PER_MESSAGE },
+    { u"averageElapsedTimePerMessage", AVERAGE_ELAPSED_TIME_PER_MESSAGE }
+  };
+
+  /*
+   * Parse a comma separated list of metric names into a metric set. Returns
+   * false if the list contains an unknown metric name.
+   */
+  bool parseMetrics(const std::u16string& value, uint32_t& metrics) {
+    if (value.empty()) {
+      metrics = ALL_METRICS;
+      return true;
+    }
+    if (value == NO_METRICS) {
+      metrics = 0;
+      return true;
+    }
+    uint32_t parsed = 0;
+    size_t start = 0;
+    while (start <= value.length()) {
+      size_t end = value.find(u',', start);
+      if (end == std::u16string::npos) {
+        end = value.length();
+      }
+      std::u16string name(value, start, end - start);
+      if (!name.empty()) {
+        size_t i = 0;
+        while (i < sizeof(METRIC_NAMES) / sizeof(METRIC_NAMES[0]) && name != METRIC_NAMES[i].name) {
+          ++i;
+        }
+        if (i == sizeof(METRIC_NAMES) / sizeof(METRIC_NAMES[0])) {
+          return false;
+        }
+        parsed |= METRIC_NAMES[i].metric;
+      }
+      start = end + 1;
+    }
+    metrics = parsed;
+    return true;
+  }
+
+  /*
+   * Split a comma separated list of flow name patterns, which are matched
+   * against the UTF-8 form of the unique flow name.
+   */
+  std::vector<std::string> parsePatterns(const std::u16string& value) {
+    std::vector<std::string> patterns;
+    size_t start = 0;
+    while (start <= value.length()) {
+      size_t end = value.find(u',', start);
+      if (end == std::u16string::npos) {
+        end = value.length();
+      }
+      if (end > start) {
+        patterns.push_back(utf_to_utf<char>(value.substr(start, end - start)));
+      }
+      start = end + 1;
+    }
+    return patterns;
+  }
+
+  /*
+   * Append UTF-16 text to a string as UTF-8, optionally replacing '.' with '_'
+   * so that a name cannot add levels to a metric name. Unpaired surrogates are
+   * skipped, as utf_to_utf does.
+   */
+  void appendUtf8(std::string& out, const char16_t* text, size_t length, bool replaceDots) {
+    for (size_t i = 0; i < length; ++i) {
+      uint32_t c = text[i];
+      if (c >= 0xD800 && c <= 0xDBFF && i + 1 < length && text[i + 1] >= 0xDC00 && text[i + 1] <= 0xDFFF) {
+        c = 0x10000 + ((c - 0xD800) << 10) + (text[++i] - 0xDC00);
+      } else if (c >= 0xD800 && c <= 0xDFFF) {
+        continue;
+      }
+      if (c < 0x80) {
+        out += (replaceDots && c == '.') ? '_' : static_cast<char>(c);
+      } else if (c < 0x800) {
+        out += static_cast<char>(0xC0 | (c >> 6));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+      } else if (c < 0x10000) {
+        out += static_cast<char>(0xE0 | (c >> 12));
+        out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+      } else {
+        out += static_cast<char>(0xF0 | (c >> 18));
+        out += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+      }
+    }
+  }
+
+  /*
+   * Append one level of a metric name, with its separator, if the name is set.
+   */
+  void appendLevel(std::string& out, const CciChar* name) {
+    if (name != NULL && *name != 0) {
+      appendUtf8(out, name, std::char_traits<char16_t>::length(name), true);
+      out += '.';
+    }
+  }
+
+  /*
+   * Parse a property value that must be a non-negative decimal number.
+   */
+  bool parseNumber(const std::u16string& value, uint64_t& number) {
+    if (value.empty() || value.length() > 18) {
+      return false;
+    }
+    number = 0;
+    for (size_t i = 0; i < value.length(); ++i) {
+      if (value[i] < u'0' || value[i] > u'9') {
+        return false;
+      }
+      number = (number * 10) + (value[i] - u'0');
+    }
+    return true;
+  }
+
+  /*
+   * Format a number as the value of a property.
+   */
+  std::u16string formatNumber(uint64_t number) {
+    char16_t digits[20];
+    size_t start = sizeof(digits) / sizeof(digits[0]);
+    do {
+      digits[--start] = static_cast<char16_t>(u'0' + (number % 10));
+      number /= 10;
+    } while (number != 0);
+    return std::u16string(digits + start, digits + (sizeof(digits) / sizeof(digits[0])));
+  }
+
+  /*
+   * Check that a port is empty (not configured) or a number from 1 to 65535.
+   */
+  bool validPort(const std::u16string& value) {
+    uint64_t port = 0;
+    return value.empty() || (parseNumber(value, port) && port > 0 && port <= 65535);
+  }
+
+  /*
+   * Copy a property name or value into the buffer supplied by the IBM Integration
+   * Bus runtime, or return CCI_BUFFER_TOO_SMALL and the required size of the buffer.
+   */
+  CciSize copyToBuffer(int* rc, const std::u16string& value, CciChar* buffer, CciSize bufferLength) {
+    if (bufferLength < value.length()) {
+      if (rc) *rc = CCI_BUFFER_TOO_SMALL;
+      return value.length();
+    }
+    if (rc) *rc = CCI_SUCCESS;
+    return value.copy(buffer, value.length());
+  }
+
+  typedef StatsdStatsWriter::Config Config;
+  typedef StatsdStatsWriter::Statistics Statistics;
+
+  /*
+   * These check a new value for a property, and store any parsed form of it in
+   * the staged configuration. A value that is not valid leaves the staged
+   * configuration unchanged.
+   */
+  bool validProtocol(const std::u16string& value, Config& staged) {
+    return value == UDP_PROTOCOL || value == TCP_FRAMED_PROTOCOL;
+  }
+
+  bool validPort(const std::u16string& value, Config& staged) {
+    return validPort(value);
+  }
+
+  bool validSnapshotMetrics(const std::u16string& value, Config& staged) {
+    return parseMetrics(value, staged.iSnapshotMetricSet);
+  }
+
+  bool validArchiveMetrics(const std::u16string& value, Config& staged) {
+    return parseMetrics(value, staged.iArchiveMetricSet);
+  }
+
+  bool validMemoryLimit(const std::u16string& value, Config& staged) {
+    uint64_t number = 0;
+    if (!parseNumber(value, number) || number < PacketPool::MAX_BUFFER_SIZE || number > MAXIMUM_MEMORY_LIMIT) {
+      return false;
+    }
+    staged.iMemoryLimitBytes = static_cast<size_t>(number);
+    return true;
+  }
+
+  /*
+   * Send limits other than 0 are only accepted if the scheduler can pace sends.
+   */
+  bool parseSendLimit(const std::u16string& value, uint64_t maximum, uint64_t& number) {
+    return parseNumber(value, number) && number <= maximum && (number == 0 || SendScheduler::supported());
+  }
+
+  bool validSendPacketRate(const std::u16string& value, Config& staged) {
+    uint64_t number = 0;
+    if (!parseSendLimit(value, MAXIMUM_SEND_RATE, number)) {
+      return false;
+    }
+    staged.iSendPacketsPerSecond = number;
+    return true;
+  }
+
+  bool validSendByteRate(const std::u16string& value, Config& staged) {
+    uint64_t number = 0;
+    if (!parseSendLimit(value, MAXIMUM_SEND_RATE, number)) {
+      return false;
+    }
+    staged.iSendBytesPerSecond = number;
+    return true;
+  }
+
+  bool validSendJitter(const std::u16string& value, Config& staged) {
+    uint64_t number = 0;
+    if (!parseSendLimit(value, MAXIMUM_SEND_JITTER, number)) {
+      return false;
+    }
+    staged.iSendJitterMillis = static_cast<uint32_t>(number);
+    return true;
+  }
+
+  bool validCriticalFlows(const std::u16string& value, Config& staged) {
+    staged.iCriticalPatterns = parsePatterns(value);
+    return true;
+  }
+
+  /*
+   * A property of this statistics writer. A property either holds a value in the
+   * configuration, which may need to be validated, or is a read-only statistic.
+   */
+  struct Property {
+    const std::u16string* name;
+    std::u16string Config::* value;
+    bool (*validate)(const std::u16string& value, Config& staged);
+    uint64_t StatsdStatsWriter::Statistics::* statistic;
+  };
+
+  /*
+   * The properties of this statistics writer, in the order that they are
+   * returned by getAttributeName().
+   */
+  const Property PROPERTIES[] = {
+    { &HOSTNAME_NAME,                  &Config::iHostname,          NULL,                  NULL },
+    { &PORT_NAME,                      &Config::iPort,              &validPort,            NULL },
+    { &PROTOCOL_NAME,                  &Config::iProtocol,          &validProtocol,        NULL },
+    { &ARCHIVE_HOSTNAME_NAME,          &Config::iArchiveHostname,   NULL,                  NULL },
+    { &ARCHIVE_PORT_NAME,              &Config::iArchivePort,       &validPort,            NULL },
+    { &SNAPSHOT_NAMESPACE_NAME,        &Config::iSnapshotNamespace, NULL,                  NULL },
+    { &ARCHIVE_NAMESPACE_NAME,         &Config::iArchiveNamespace,  NULL,                  NULL },
+    { &SNAPSHOT_METRICS_NAME,          &Config::iSnapshotMetrics,   &validSnapshotMetrics, NULL },
+    { &ARCHIVE_METRICS_NAME,           &Config::iArchiveMetrics,    &validArchiveMetrics,  NULL },
+    { &MEMORY_LIMIT_NAME,              &Config::iMemoryLimit,       &validMemoryLimit,     NULL },
+    { &CAPTURE_FILE_NAME,              &Config::iCaptureFile,       NULL,                  NULL },
+    { &SEND_PACKET_RATE_NAME,          &Config::iSendPacketRate,    &validSendPacketRate,  NULL },
+    { &SEND_BYTE_RATE_NAME,            &Config::iSendByteRate,      &validSendByteRate,    NULL },
+    { &SEND_JITTER_NAME,               &Config::iSendJitter,        &validSendJitter,      NULL },
+    { &CRITICAL_FLOWS_NAME,            &Config::iCriticalFlows,     &validCriticalFlows,   NULL },
+    { &PACKET_BUFFERS_NAME,            NULL,                        NULL,                  &Statistics::iPacketBuffers },
+    { &PACKET_BUFFERS_IN_USE_NAME,     NULL,                        NULL,                  &Statistics::iPacketBuffersInUse },
+    { &PACKET_BUFFERS_HIGH_WATER_NAME, NULL,                        NULL,                  &Statistics::iPacketBuffersHighWater },
+    { &PACKET_BUFFERS_EXHAUSTED_NAME,  NULL,                        NULL,                  &Statistics::iPacketBuffersExhausted },
+    { &PACKET_BUFFERS_OVERSIZED_NAME,  NULL,                        NULL,                  &Statistics::iPacketBuffersOversized },
+    { &SEND_DEFERRED_NAME,             NULL,                        NULL,                  &Statistics::iSendDeferred },
+    { &SEND_SHED_NAME,                 NULL,                        NULL,                  &Statistics::iSendShed },
+    { &SEND_FAILED_NAME,               NULL,                        NULL,                  &Statistics::iSendFailed }
+  };
+  const int PROPERTY_COUNT = sizeof(PROPERTIES) / sizeof(PROPERTIES[0]);
+
+  /*
+   * Find the property with the specified name, or return NULL if there is none.
+   */
+  const Property* findProperty(const CciChar* name) {
+    for (int i = 0; i < PROPERTY_COUNT; ++i) {
+      if (*PROPERTIES[i].name == name) {
+        return &PROPERTIES[i];
+      }
+    }
+    return NULL;
+  }
+
+}
+
+/*
+ * Default values for the properties.
+ */
+StatsdStatsWriter::Config::Config()
+ : iProtocol(UDP_PROTOCOL),
+   iArchiveNamespace(u"archive"),
+   iMemoryLimit(formatNumber(DEFAULT_MEMORY_LIMIT)),
+   iSendPacketRate(u"0"),
+   iSendByteRate(u"0"),
+   iSendJitter(u"0"),
+   iSnapshotMetricSet(ALL_METRICS),
+   iArchiveMetricSet(ALL_METRICS),
+   iMemoryLimitBytes(DEFAULT_MEMORY_LIMIT),
+   iSendPacketsPerSecond(0),
+   iSendBytesPerSecond(0),
+   iSendJitterMillis(0)
+{
 }
 
 /*
  * Constructor.
  */
 StatsdStatsWriter::StatsdStatsWriter(UdpSocket *socket)
- : iWriter(nullptr) 
+ : iWriter(nullptr),
+   iStagedChanged(false),
+   iStatistics(),
+   iPool(DEFAULT_MEMORY_LIMIT, UdpSocket::MAX_PACKET_SIZE),
+   iScheduler(),
+   iPoolPacketSize(UdpSocket::MAX_PACKET_SIZE),
+   iPoolResizePending(false)
 {
+  publishStatistics();
+
+  /*
+   * The host name is part of every metric name; look it up once.
+   */
+  boost::system::error_code error;
+  std::string hostname(host_name(error));
+  setMetricHostname(error ? std::string("unknown") : hostname);
+
   /*
    * Set the socket initially to the passed-in socket if it has
    * been set; this is normally used for unit testing with a mock
    * socket.
    */
-  if ( socket != NULL )
+  if ( socket != NULL ) {
     iSocket.reset(socket);
+    iSocket->setScheduler(&iScheduler);
+  }
 
   /*
    * Create the virtual function table for the statistics writer.
@@ -161,7 +615,10 @@ StatsdStatsWriter::StatsdStatsWriter(UdpSocket *socket)
  * Destructor.
  */
 StatsdStatsWriter::~StatsdStatsWriter() {
-
+  /*
+   * Send anything the scheduler is still holding while the sockets exist.
+   */
+  iScheduler.drain(NULL);
 }
 
 /*
@@ -172,25 +629,11 @@ StatsdStatsWriter::~StatsdStatsWriter() {
  * the required size of the buffer.
  */
 CciSize StatsdStatsWriter::getAttributeName(int* rc, int index, CciChar* buffer, CciSize bufferLength) const {
-  switch (index) {
-  case 0:
-    if (bufferLength < HOSTNAME_NAME.length()) {
-      if (rc) *rc = CCI_BUFFER_TOO_SMALL;
-      return HOSTNAME_NAME.length();
-    }
-    if (rc) *rc = CCI_SUCCESS;
-    return HOSTNAME_NAME.copy(buffer, HOSTNAME_NAME.length());
-  case 1:
-    if (bufferLength < PORT_NAME.length()) {
-      if (rc) *rc = CCI_BUFFER_TOO_SMALL;
-      return PORT_NAME.length();
-    }
-    if (rc) *rc = CCI_SUCCESS;
-    return PORT_NAME.copy(buffer, PORT_NAME.length());
-  default:
-    *rc = CCI_ATTRIBUTE_UNKNOWN;
+  if (index < 0 || index >= PROPERTY_COUNT) {
+    if (rc) *rc = CCI_ATTRIBUTE_UNKNOWN;
     return 0;
   }
+  return copyToBuffer(rc, *PROPERTIES[index].name, buffer, bufferLength);
 }
 
 /*
@@ -198,48 +641,195 @@ CciSize StatsdStatsWriter::getAttributeName(int* rc, int index, CciChar* buffer,
  * specified name. If no property exists with the specified name, then this function
  * should return CCI_ATTRIBUTE_UNKNOWN. If the specified buffer is too small for the
  * value of the property, then this function should return CCI_BUFFER_TOO_SMALL and
- * the required size of the buffer.
+ * the required size of the buffer. Values that have been set but not yet applied by
+ * write() are reported, so that the reported values match the last command.
  */
 CciSize StatsdStatsWriter::getAttribute(int* rc, const CciChar* name, CciChar* buffer, CciSize bufferLength) const {
-  if (HOSTNAME_NAME == name) {
-    if (bufferLength < iHostname.length()) {
-      if (rc) *rc = CCI_BUFFER_TOO_SMALL;
-      return iHostname.length();
-    }
-    if (rc) *rc = CCI_SUCCESS;
-    return iHostname.copy(buffer, iHostname.length());
-  } else if (PORT_NAME == name) {
-    if (bufferLength < iPort.length()) {
-      if (rc) *rc = CCI_BUFFER_TOO_SMALL;
-      return iPort.length();
-    }
-    if (rc) *rc = CCI_SUCCESS;
-    return iPort.copy(buffer, iPort.length());
-  } else {
+  const Property* property = findProperty(name);
+  if (property == NULL) {
     if (rc) *rc = CCI_ATTRIBUTE_UNKNOWN;
     return 0;
   }
+  std::lock_guard<std::mutex> lock(iMutex);
+  if (property->value != NULL) {
+    return copyToBuffer(rc, iStaged.*(property->value), buffer, bufferLength);
+  }
+  return copyToBuffer(rc, formatNumber(iStatistics.*(property->statistic)), buffer, bufferLength);
 }
 
 /*
  * Called by the IBM Integration Bus runtime to set the value of the property with the
  * specified name. If no property exists with the specified name, then this function
- * should return CCI_ATTRIBUTE_UNKNOWN.
+ * should return CCI_ATTRIBUTE_UNKNOWN. If the value is not valid for the property,
+ * or the property is read-only, then this function should return CCI_FAILURE and
+ * leave the property unchanged.
  */
 void StatsdStatsWriter::setAttribute(int* rc, const CciChar* name, const CciChar* value) {
-  if (HOSTNAME_NAME == name) {
-    iHostname.assign(value);
-    if (rc) *rc = CCI_SUCCESS;
-  } else if (PORT_NAME == name) {
-    iPort.assign(value);
-    if (rc) *rc = CCI_SUCCESS;
-  } else {
+  const Property* property = findProperty(name);
+  if (property == NULL) {
     if (rc) *rc = CCI_ATTRIBUTE_UNKNOWN;
+    return;
+  }
+  std::lock_guard<std::mutex> lock(iMutex);
+  if (property->value == NULL || (property->validate != NULL && !property->validate(value, iStaged))) {
+    if (rc) *rc = CCI_FAILURE;
+    return;
   }
-  if (!iHostname.empty() && !iPort.empty()) {
-    iSocket.reset(new UdpSocket(iHostname, iPort));
+  (iStaged.*(property->value)).assign(value);
+  iStagedChanged = true;
+  if (rc) *rc = CCI_SUCCESS;
+}
+
+/*
+ * Make a copy of the staged configuration the active configuration. A socket is only replaced
+ * if its destination has changed, in which case anything it has batched or that
+ * the scheduler holds for it is sent to the old destination first; otherwise the
+ * socket and its buffers are reused.
+ */
+void StatsdStatsWriter::applyConfig(const Config& staged) {
+  const std::u16string& activeArchivePort = iConfig.iArchivePort.empty() ? iConfig.iPort : iConfig.iArchivePort;
+  const std::u16string& stagedArchivePort = staged.iArchivePort.empty() ? staged.iPort : staged.iArchivePort;
+  bool protocolChanged = (staged.iProtocol != iConfig.iProtocol);
+
+  /*
+   * With no hostname there is nothing to connect to, so a socket passed to
+   * the constructor is kept whatever the port or protocol.
+   */
+  bool noHostname = staged.iHostname.empty() && iConfig.iHostname.empty();
+  if (!noHostname && (protocolChanged || staged.iHostname != iConfig.iHostname || staged.iPort != iConfig.iPort)) {
+    if (iSocket.get() != NULL) {
+      iSocket->flush();
+      iScheduler.drain(iSocket.get());
+    }
+    iSocketRetry = Retry();
+    openSocket(iSocket, iSocketRetry, staged.iHostname, staged.iPort, staged.iProtocol);
+  }
+  if (protocolChanged || staged.iArchiveHostname != iConfig.iArchiveHostname || stagedArchivePort != activeArchivePort) {
+    if (iArchiveSocket.get() != NULL) {
+      iArchiveSocket->flush();
+      iScheduler.drain(iArchiveSocket.get());
+    }
+    iArchiveSocketRetry = Retry();
+    openSocket(iArchiveSocket, iArchiveSocketRetry, staged.iArchiveHostname, stagedArchivePort, staged.iProtocol);
+  }
+
+  /*
+   * The packet buffers are sized for the protocol's largest packet. They can
+   * only be reallocated once the sockets have given theirs back. If that still
+   * fails, then the active configuration keeps the old memory limit, and the
+   * next record tries again.
+   */
+  size_t activeMemoryLimitBytes = iConfig.iMemoryLimitBytes;
+  std::u16string activeMemoryLimit = iConfig.iMemoryLimit;
+  size_t poolPacketSize = packetSize(staged.iProtocol);
+  bool poolResized = true;
+  if (poolPacketSize != iPoolPacketSize || staged.iMemoryLimitBytes != iConfig.iMemoryLimitBytes) {
+    if (iSocket.get() != NULL) {
+      iSocket->flush();
+    }
+    if (iArchiveSocket.get() != NULL) {
+      iArchiveSocket->flush();
+    }
+    iScheduler.drain(NULL);
+    poolResized = iPool.resize(staged.iMemoryLimitBytes, poolPacketSize);
+    if (poolResized) {
+      iPoolPacketSize = poolPacketSize;
+    } else if (!iPoolResizePending) {
+      const char16_t* traceText = u"Cannot reallocate the packet buffers while some are in use";
+      const char16_t* inserts[] = { traceText, staged.iMemoryLimit.c_str() };
+      cciLogWithInsertsW(nullptr, CCI_LOG_WARNING, __FILE__, __LINE__, __func__, u"BIPmsgs", 2113, traceText, inserts, sizeof(inserts) / sizeof(inserts[0]));
+    }
+    iPoolResizePending = !poolResized;
+  }
+
+  if (staged.iSendPacketsPerSecond != iConfig.iSendPacketsPerSecond ||
+      staged.iSendBytesPerSecond != iConfig.iSendBytesPerSecond ||
+      staged.iSendJitterMillis != iConfig.iSendJitterMillis) {
+    iScheduler.configure(staged.iSendPacketsPerSecond, staged.iSendBytesPerSecond, staged.iSendJitterMillis);
+  }
+
+  /*
+   * Each change of capture file starts a new capture session. If the file
+   * cannot be opened, then capture stays off.
+   */
+  if (staged.iCaptureFile != iConfig.iCaptureFile) {
+    iCapture.reset();
+    if (!staged.iCaptureFile.empty()) {
+      iCapture.reset(new CaptureWriter(utf_to_utf<char>(staged.iCaptureFile)));
+      if (!iCapture->good()) {
+        logCaptureFailure(u"Cannot open the capture file; records are not captured", staged.iCaptureFile, iCapture->error());
+        iCapture.reset();
+      }
+      iCaptureStart = boost::posix_time::microsec_clock::universal_time();
+    }
+  }
+
+  iConfig = staged;
+  if (!poolResized) {
+    iConfig.iMemoryLimitBytes = activeMemoryLimitBytes;
+    iConfig.iMemoryLimit = activeMemoryLimit;
+  }
+}
+
+/*
+ * Replace the socket with one for the specified destination. If a configured
+ * destination cannot be resolved, then the stream stays disconnected and
+ * retrySockets() tries again after a delay that grows with each failure.
+ */
+void StatsdStatsWriter::openSocket(SocketPtr& socket, Retry& retry, const std::u16string& hostname, const std::u16string& port, const std::u16string& protocol) {
+  socket.reset(createSocket(hostname, port, protocol));
+  if (socket.get() != NULL || hostname.empty() || port.empty()) {
+    retry = Retry();
+    return;
+  }
+  if (retry.iDelay.total_seconds() == 0) {
+    retry.iDelay = boost::posix_time::seconds(MIN_RETRY_DELAY_SECONDS);
   } else {
-    iSocket.reset();
+    retry.iDelay = std::min(retry.iDelay * 2, boost::posix_time::time_duration(boost::posix_time::seconds(MAX_RETRY_DELAY_SECONDS)));
+  }
+  retry.iAt = boost::posix_time::microsec_clock::universal_time() + retry.iDelay;
+}
+
+/*
+ * Try again to create the sockets for destinations that could not be resolved,
+ * if their retry is due.
+ */
+void StatsdStatsWriter::retrySockets() {
+  boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+  if (!iSocketRetry.iAt.is_not_a_date_time() && now >= iSocketRetry.iAt) {
+    openSocket(iSocket, iSocketRetry, iConfig.iHostname, iConfig.iPort, iConfig.iProtocol);
+  }
+  if (!iArchiveSocketRetry.iAt.is_not_a_date_time() && now >= iArchiveSocketRetry.iAt) {
+    const std::u16string& archivePort = iConfig.iArchivePort.empty() ? iConfig.iPort : iConfig.iArchivePort;
+    openSocket(iArchiveSocket, iArchiveSocketRetry, iConfig.iArchiveHostname, archivePort, iConfig.iProtocol);
+  }
+}
+
+/*
+ * Create a socket for the specified destination, or return NULL if the destination
+ * has not been configured or cannot be resolved. A failure is logged, as metrics for
+ * the destination are lost until it can be resolved.
+ */
+UdpSocket* StatsdStatsWriter::createSocket(const std::u16string& hostname, const std::u16string& port, const std::u16string& protocol) {
+  if (hostname.empty() || port.empty()) {
+    return NULL;
+  }
+  try {
+    UdpSocket* socket = NULL;
+    if (protocol == TCP_FRAMED_PROTOCOL) {
+      socket = new FramedTcpSocket(hostname, port, &iPool);
+    } else {
+      socket = new UdpSocket(hostname, port, &iPool);
+    }
+    socket->setScheduler(&iScheduler);
+    return socket;
+  } catch (const std::exception& e) {
+    std::u16string destination(hostname + u':' + port);
+    std::u16string reason(utf_to_utf<char16_t>(std::string(e.what())));
+    const char16_t* traceText = u"Cannot create a socket for the StatsD destination";
+    const char16_t* inserts[] = { traceText, destination.c_str(), reason.c_str() };
+    cciLogWithInsertsW(nullptr, CCI_LOG_WARNING, __FILE__, __LINE__, __func__, u"BIPmsgs", 2113, traceText, inserts, sizeof(inserts) / sizeof(inserts[0]));
+    return NULL;
   }
 }
 
@@ -250,53 +840,136 @@ void StatsdStatsWriter::setAttribute(int* rc, const CciChar* name, const CciChar
  */
 void StatsdStatsWriter::write(const CsiStatsRecord* record) {
 
+  /*
+   * Apply any property changes made since the last record. The runtime may set
+   * properties on another thread, so the staged configuration is copied under
+   * the lock and applied from the copy.
+   */
+  bool changed = false;
+  {
+    std::lock_guard<std::mutex> lock(iMutex);
+    if (iStagedChanged) {
+      iApplying = iStaged;
+      iStagedChanged = false;
+      changed = true;
+    }
+  }
+  if (changed || iPoolResizePending) {
+    applyConfig(iApplying);
+  }
+
+  writeRecord(record);
+  publishStatistics();
+}
+
+/*
+ * Copy the usage counters of the packet buffers and the scheduler, which are
+ * only safe to read on this thread, for getAttribute() to report.
+ */
+void StatsdStatsWriter::publishStatistics() {
+  Statistics statistics;
+  statistics.iPacketBuffers = iPool.bufferCount();
+  statistics.iPacketBuffersInUse = iPool.inUse();
+  statistics.iPacketBuffersHighWater = iPool.highWater();
+  statistics.iPacketBuffersExhausted = iPool.exhausted();
+  statistics.iPacketBuffersOversized = iPool.oversized();
+  statistics.iSendDeferred = iScheduler.deferred();
+  statistics.iSendShed = iScheduler.shedCount();
+  statistics.iSendFailed = iScheduler.failedCount();
+  std::lock_guard<std::mutex> lock(iMutex);
+  iStatistics = statistics;
+}
+
+/*
+ * Write the metrics for one statistics record with the active configuration.
+ */
+void StatsdStatsWriter::writeRecord(const CsiStatsRecord* record) {
+
+  /*
+   * Try again to resolve any destination that could not be resolved earlier.
+   */
+  if (!iSocketRetry.iAt.is_not_a_date_time() || !iArchiveSocketRetry.iAt.is_not_a_date_time()) {
+    retrySockets();
+  }
+
+  /*
+   * Give the buffers of packets the scheduler has sent back to the pool.
+   */
+  if (iScheduler.running()) {
+    iScheduler.reclaim();
+  }
+
+  /*
+   * Capture the record for replay, with the time since capture started so that
+   * the replay can reproduce the original pacing.
+   */
+  if (iCapture.get() != NULL) {
+    boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - iCaptureStart;
+    if (!iCapture->write(record, static_cast<uint64_t>(std::max<int64_t>(0, elapsed.total_milliseconds())))) {
+      logCaptureFailure(u"Cannot write to the capture file; capture has stopped", iConfig.iCaptureFile, iCapture->error());
+      iCapture.reset();
+    }
+  }
+
+  /*
+   * Snapshot and archive records cover different intervals, so they are written
+   * with their own metric names, metric selection, and (optionally) destination.
+   * Archive records for a destination without a socket, because it could not
+   * be resolved yet, are dropped rather than sent to the snapshot destination.
+   */
+  bool archive = (record->type == CSI_STATS_RECORD_TYPE_ARCHIVE);
+  UdpSocket* socket = iSocket.get();
+  if (archive && !iConfig.iArchiveHostname.empty()) {
+    socket = iArchiveSocket.get();
+  }
+  uint32_t metrics = archive ? iConfig.iArchiveMetricSet : iConfig.iSnapshotMetricSet;
+  const std::u16string& metricnamespace = archive ? iConfig.iArchiveNamespace : iConfig.iSnapshotNamespace;
+
   /*
    * If not connected, or we haven't been configured, then bail out early.
    */
-#if defined(AVOID_CXX11)
-  if (iSocket.get() == NULL) { return; }
-#else
-    if (!iSocket) { return; }
-#endif
+  if (socket == NULL || metrics == 0) { return; }
 
   /*
    * Calculate the base name for all of the metrics. This is as follows:
-   * hostname.nodename.servername.uniqueflowname
+   * [namespace.]hostname.nodename.servername.uniqueflowname
+   * The unique flow name is built from the application, library, and
+   * message flow names. The name is built in place in a reused string, so
+   * that no memory is allocated once it has grown to size.
    */
-  std::u16string hostname(utf_to_utf<char16_t>(host_name()));
-  hostname = hostname.substr(0, hostname.find(u'.'));
-  std::u16string nodename(record->messageFlow.brokerLabel);
-  std::replace(nodename.begin(), nodename.end(), u'.', u'_');
-  std::u16string servername(record->messageFlow.executionGroupName);
-  std::replace(servername.begin(), servername.end(), u'.', u'_');
-  std::u16string uniqueservername;
-  uniqueservername += hostname + u'.';
-  if (!nodename.empty()) {
-    uniqueservername += nodename + u'.';
+  iMetricBase.clear();
+  if (!metricnamespace.empty()) {
+    appendUtf8(iMetricBase, metricnamespace.data(), metricnamespace.length(), false);
+    iMetricBase += '.';
   }
-  if (!servername.empty()) {
-    uniqueservername += servername + u'.';
+  iMetricBase += iHostPrefix;
+  iMetricBase += '.';
+  appendLevel(iMetricBase, record->messageFlow.brokerLabel);
+  appendLevel(iMetricBase, record->messageFlow.executionGroupName);
+  size_t uniqueflowname = iMetricBase.length();
+  appendLevel(iMetricBase, record->messageFlow.applicationName);
+  appendLevel(iMetricBase, record->messageFlow.libraryName);
+  if (record->messageFlow.messageFlowName != NULL) {
+    const CciChar* messageflow = record->messageFlow.messageFlowName;
+    appendUtf8(iMetricBase, messageflow, std::char_traits<char16_t>::length(messageflow), true);
   }
+  const char* flowname = iMetricBase.data() + uniqueflowname;
+  size_t flownameLength = iMetricBase.length() - uniqueflowname;
 
   /*
-   * The unique flow name is built from the application, library, and
-   * message flow names.
+   * Decide how the scheduler treats this flow's packets: critical flows go
+   * first, and the others are spread across the jitter window.
    */
-  std::u16string application(record->messageFlow.applicationName);
-  std::replace(application.begin(), application.end(), u'.', u'_');
-  std::u16string library(record->messageFlow.libraryName);
-  std::replace(library.begin(), library.end(), u'.', u'_');
-  std::u16string messageflow(record->messageFlow.messageFlowName);
-  std::replace(messageflow.begin(), messageflow.end(), u'.', u'_');
-  std::u16string uniqueflowname;
-  if (!application.empty()) {
-    uniqueflowname += application + u'.';
+  bool critical = false;
+  for (size_t i = 0; i < iConfig.iCriticalPatterns.size() && !critical; ++i) {
+    critical = SendScheduler::matchesPattern(iConfig.iCriticalPatterns[i], flowname, flownameLength);
   }
-  if (!library.empty()) {
-    uniqueflowname += library + u'.';
+  uint32_t delayMillis = 0;
+  if (!critical && iConfig.iSendJitterMillis != 0) {
+    delayMillis = SendScheduler::jitterOffset(flowname, flownameLength, iConfig.iSendJitterMillis);
   }
-  uniqueflowname += messageflow;
-  std::u16string metricbase = uniqueservername + uniqueflowname + u'.';
+  iMetricBase += '.';
+  socket->schedule(critical, delayMillis);
 
   /*
    * Calculate the time interval for this record.
@@ -308,16 +981,41 @@ void StatsdStatsWriter::write(const CsiStatsRecord* record) {
   /*
    * Generate and send all of the metrics.
    */
-  writeMessageFlowMetrics(metricbase, record, duration);
+  writeMessageFlowMetrics(*socket, iMetricBase, record, duration, metrics);
 
   /*
    * Ensure that all data is written to the socket. The UdpSocket class will
    * package the metrics into as few UDP packets as possible.
    */
-  iSocket->flush();
+  socket->flush();
 
 }
 
+/*
+ * Log that capture is off although a capture file is set, so that an operator
+ * can tell why the file is empty or ends early.
+ */
+void StatsdStatsWriter::logCaptureFailure(const char16_t* traceText, const std::u16string& path, int error) {
+  std::u16string reason(utf_to_utf<char16_t>(std::string(std::strerror(error))));
+  const char16_t* inserts[] = { traceText, path.c_str(), reason.c_str() };
+  cciLogWithInsertsW(nullptr, CCI_LOG_WARNING, __FILE__, __LINE__, __func__, u"BIPmsgs", 2113, traceText, inserts, sizeof(inserts) / sizeof(inserts[0]));
+}
+
+/*
+ * Set the host name used in metric names; only the part before the first '.'
+ * is used.
+ */
+void StatsdStatsWriter::setMetricHostname(const std::string& hostname) {
+  iHostPrefix = hostname.substr(0, hostname.find('.'));
+}
+
+/*
+ * The largest packet of the specified protocol, which sizes the packet buffers.
+ */
+size_t StatsdStatsWriter::packetSize(const std::u16string& protocol) {
+  return (protocol == TCP_FRAMED_PROTOCOL) ? FramedTcpSocket::MAX_BATCH_SIZE : UdpSocket::MAX_PACKET_SIZE;
+}
+
 /*
  * Calculate the time in milliseconds since the epoch from the specified date and time.
  */
@@ -338,53 +1036,71 @@ uint64_t StatsdStatsWriter::calculateMillis(const CciDate& date, const CciTime&
 /*
  * Write all the message flow specific metrics from the specified statistics record.
  */
-void StatsdStatsWriter::writeMessageFlowMetrics(const std::u16string& metricbase, const CsiStatsRecord* record, uint64_t duration) {
+void StatsdStatsWriter::writeMessageFlowMetrics(UdpSocket& socket, const std::string& metricbase, const CsiStatsRecord* record, uint64_t duration, uint32_t metrics) {
 
   /*
    * Minimum and maximum CPU time and elapsed time in seconds.
    */
-  writeMetric(metricbase, u"minimumCPUTime", record->messageFlow.minimumCPUTime / 1000.0f);
-  writeMetric(metricbase, u"maximumCPUTime", record->messageFlow.maximumCPUTime / 1000.0f);
-  writeMetric(metricbase, u"minimumElapsedTime", record->messageFlow.minimumElapsedTime / 1000.0f);
-  writeMetric(metricbase, u"maximumElapsedTime", record->messageFlow.maximumElapsedTime / 1000.0f);
+  if (metrics & MINIMUM_CPU_TIME) {
+    writeMetric(socket, metricbase, "minimumCPUTime", record->messageFlow.minimumCPUTime / 1000.0f);
+  }
+  if (metrics & MAXIMUM_CPU_TIME) {
+    writeMetric(socket, metricbase, "maximumCPUTime", record->messageFlow.maximumCPUTime / 1000.0f);
+  }
+  if (metrics & MINIMUM_ELAPSED_TIME) {
+    writeMetric(socket, metricbase, "minimumElapsedTime", record->messageFlow.minimumElapsedTime / 1000.0f);
+  }
+  if (metrics & MAXIMUM_ELAPSED_TIME) {
+    writeMetric(socket, metricbase, "maximumElapsedTime", record->messageFlow.maximumElapsedTime / 1000.0f);
+  }
 
   /*
    * Average message rate in messages/second.
    */
-  double averageMessageRate = 0;
-  if (record->messageFlow.totalInputMessages > 0) {
-    averageMessageRate = record->messageFlow.totalInputMessages / (duration / 1000.0f);
+  if (metrics & AVERAGE_MESSAGE_RATE) {
+    double averageMessageRate = 0;
+    if (record->messageFlow.totalInputMessages > 0) {
+      averageMessageRate = record->messageFlow.totalInputMessages / (duration / 1000.0f);
+    }
+    writeMetric(socket, metricbase, "averageMessageRate", averageMessageRate);
   }
-  writeMetric(metricbase, u"averageMessageRate", averageMessageRate);
 
   /*
    * Average CPU time per message in seconds.
    */
-  double averageCPUTimePerMessage = 0;
-  if (record->messageFlow.totalInputMessages > 0) {
-    averageCPUTimePerMessage = (record->messageFlow.totalCPUTime / static_cast<double>(record->messageFlow.totalInputMessages)) / 1000.0f;
+  if (metrics & AVERAGE_CPU_TIME_PER_MESSAGE) {
+    double averageCPUTimePerMessage = 0;
+    if (record->messageFlow.totalInputMessages > 0) {
+      averageCPUTimePerMessage = (record->messageFlow.totalCPUTime / static_cast<double>(record->messageFlow.totalInputMessages)) / 1000.0f;
+    }
+    writeMetric(socket, metricbase, "averageCPUTimePerMessage", averageCPUTimePerMessage);
   }
-  writeMetric(metricbase, u"averageCPUTimePerMessage", averageCPUTimePerMessage);
 
   /*
    * Average elapsed time per message in seconds.
    */
-  double averageElapsedTimePerMessage = 0;
-  if (record->messageFlow.totalInputMessages > 0) {
-    averageElapsedTimePerMessage = (record->messageFlow.totalElapsedTime / static_cast<double>(record->messageFlow.totalInputMessages)) / 1000.0f;
+  if (metrics & AVERAGE_ELAPSED_TIME_PER_MESSAGE) {
+    double averageElapsedTimePerMessage = 0;
+    if (record->messageFlow.totalInputMessages > 0) {
+      averageElapsedTimePerMessage = (record->messageFlow.totalElapsedTime / static_cast<double>(record->messageFlow.totalInputMessages)) / 1000.0f;
+    }
+    writeMetric(socket, metricbase, "averageElapsedTimePerMessage", averageElapsedTimePerMessage);
   }
-  writeMetric(metricbase, u"averageElapsedTimePerMessage", averageElapsedTimePerMessage);
 
 }
 
 /*
- * Write a single metric.
+ * Write a single metric. The metric is formatted into a reused string, so that
+ * no memory is allocated per metric once the string has grown to size.
  */
-template <class T>
-void StatsdStatsWriter::writeMetric(const std::u16string& metricbase, const std::u16string& metricname, T value) {
-  std::string metric(utf_to_utf<char>(metricbase) + utf_to_utf<char>(metricname));
-  metric += ':';
-  metric += std::to_string(value);
-  metric += "|g";
-  iSocket->send(metric);
+void StatsdStatsWriter::writeMetric(UdpSocket& socket, const std::string& metricbase, const char* metricname, double value) {
+  // Same format as std::to_string(); large enough for any double.
+  char formatted[512];
+  snprintf(formatted, sizeof(formatted), "%f", value);
+  iMetric.assign(metricbase);
+  iMetric += metricname;
+  iMetric += ':';
+  iMetric += formatted;
+  iMetric += "|g";
+  socket.send(iMetric);
 }
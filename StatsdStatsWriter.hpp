@@ -10,14 +10,22 @@
 #ifndef StatsdStatsWriter_hpp
 #define StatsdStatsWriter_hpp
 
+#include "PacketPool.hpp"
+#include "SendScheduler.hpp"
+
 #include <BipCsi.h>
+#include <boost/date_time/posix_time/ptime.hpp>
 #include <memory>
 #include <string>
+#include <vector>
 
 #if defined(AVOID_CXX11)
 # include "Compat.hpp"
+#else
+# include <mutex>
 #endif
 
+class CaptureWriter;
 class UdpSocket;
 
 class StatsdStatsWriter {
@@ -32,26 +40,130 @@ public:
   void setAttribute(int* rc, const CciChar* name, const CciChar* value);
 
   void write(const CsiStatsRecord* record);
+  void setMetricHostname(const std::string& hostname);
 
   CsiStatsWriter* writer() const { return iWriter; }
 
+  /*
+   * The values of the properties of this statistics writer. Each property is
+   * described by an entry in the property table in StatsdStatsWriter.cpp.
+   */
+  struct Config {
+    Config();
+
+    std::u16string iHostname;
+    std::u16string iPort;
+    std::u16string iProtocol;
+    std::u16string iArchiveHostname;
+    std::u16string iArchivePort;
+    std::u16string iSnapshotNamespace;
+    std::u16string iArchiveNamespace;
+    std::u16string iSnapshotMetrics;
+    std::u16string iArchiveMetrics;
+    std::u16string iMemoryLimit;
+    std::u16string iCaptureFile;
+    std::u16string iSendPacketRate;
+    std::u16string iSendByteRate;
+    std::u16string iSendJitter;
+    std::u16string iCriticalFlows;
+    uint32_t iSnapshotMetricSet;
+    uint32_t iArchiveMetricSet;
+    size_t iMemoryLimitBytes;
+    uint64_t iSendPacketsPerSecond;
+    uint64_t iSendBytesPerSecond;
+    uint32_t iSendJitterMillis;
+    std::vector<std::string> iCriticalPatterns;
+  };
+
+  /*
+   * The values of the read-only properties, as of the last record written.
+   */
+  struct Statistics {
+    uint64_t iPacketBuffers;
+    uint64_t iPacketBuffersInUse;
+    uint64_t iPacketBuffersHighWater;
+    uint64_t iPacketBuffersExhausted;
+    uint64_t iPacketBuffersOversized;
+    uint64_t iSendDeferred;
+    uint64_t iSendShed;
+    uint64_t iSendFailed;
+  };
+
 private:
 
   CsiStatsWriter* iWriter;
-  std::u16string iHostname;
-  std::u16string iPort;
+
+  /*
+   * setAttribute() only changes the staged configuration; the next write()
+   * applies all staged changes together. The runtime sets the properties of
+   * one command one at a time, so a record written between two of them still
+   * sees only the earlier ones. iMutex guards the staged configuration and
+   * the published statistics, which are shared with the runtime's threads;
+   * everything else is only used by write().
+   */
+  Config iConfig;
+  Config iApplying;
+  mutable std::mutex iMutex;
+  Config iStaged;
+  bool iStagedChanged;
+  Statistics iStatistics;
+
+  // Declared before the sockets, which hold buffers from them.
+  PacketPool iPool;
+  SendScheduler iScheduler;
+
+  // The packet size the pool was last sized for, and whether a resize failed
+  // and must be tried again with the next record.
+  size_t iPoolPacketSize;
+  bool iPoolResizePending;
+#if defined(AVOID_CXX11)
+  typedef std::auto_ptr<UdpSocket> SocketPtr;
+#else
+  typedef std::unique_ptr<UdpSocket> SocketPtr;
+#endif
+  SocketPtr iSocket;
+  SocketPtr iArchiveSocket;
+
+  /*
+   * When to try again to create a socket for a configured destination that
+   * could not be resolved; not_a_date_time if no retry is due.
+   */
+  struct Retry {
+    boost::posix_time::ptime iAt;
+    boost::posix_time::time_duration iDelay;
+  };
+  Retry iSocketRetry;
+  Retry iArchiveSocketRetry;
+
 #if defined(AVOID_CXX11)
-  std::auto_ptr<UdpSocket> iSocket;
+  std::auto_ptr<CaptureWriter> iCapture;
 #else
-  std::unique_ptr<UdpSocket> iSocket;
+  std::unique_ptr<CaptureWriter> iCapture;
 #endif
+  boost::posix_time::ptime iCaptureStart;
+
+  // The local host name, up to the first '.', used in every metric name.
+  std::string iHostPrefix;
+
+  // Reused for every record and metric to avoid allocating per metric.
+  std::string iMetricBase;
+  std::string iMetric;
+
+  void applyConfig(const Config& staged);
+  void publishStatistics();
+  void writeRecord(const CsiStatsRecord* record);
+  void openSocket(SocketPtr& socket, Retry& retry, const std::u16string& hostname, const std::u16string& port, const std::u16string& protocol);
+  void retrySockets();
+  UdpSocket* createSocket(const std::u16string& hostname, const std::u16string& port, const std::u16string& protocol);
+  void logCaptureFailure(const char16_t* traceText, const std::u16string& path, int error);
+
+  static size_t packetSize(const std::u16string& protocol);
 
   uint64_t calculateMillis(const CciDate& date, const CciTime& time);
 
-  void writeMessageFlowMetrics(const std::u16string& metricbase, const CsiStatsRecord* record, uint64_t duration);
+  void writeMessageFlowMetrics(UdpSocket& socket, const std::string& metricbase, const CsiStatsRecord* record, uint64_t duration, uint32_t metrics);
 
-  template <class T>
-  void writeMetric(const std::u16string& metricbase, const std::u16string& metricname, T value);
+  void writeMetric(UdpSocket& socket, const std::string& metricbase, const char* metricname, double value);
 
 };
 
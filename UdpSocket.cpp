@@ -9,24 +9,25 @@
 
 #include "UdpSocket.hpp"
 
+#include <algorithm>
 #include <boost/locale.hpp>
+#include <cstring>
 
 using boost::asio::ip::udp;
 using boost::locale::conv::utf_to_utf;
 
-namespace {
+const size_t UdpSocket::MAX_PACKET_SIZE;
 
-  /*
-   * This is apparently the safest UDP packet size, suitable for transmission
-   * across the internet. I suspect it's overkill and can be increased.
-   */
-  const size_t UDP_MAX_PACKET_SIZE = 508;
-  
-}
-
-UdpSocket::UdpSocket(const std::u16string& hostname, const std::u16string& port)
+UdpSocket::UdpSocket(const std::u16string& hostname, const std::u16string& port, PacketPool* pool)
  : iHostname(hostname),
    iPort(port),
+   iMaxPacketSize(MAX_PACKET_SIZE),
+   iOwnPool(pool ? 0 : PacketPool::MAX_BUFFER_SIZE, MAX_PACKET_SIZE),
+   iPool(pool ? pool : &iOwnPool),
+   iPacket(NULL),
+   iScheduler(NULL),
+   iCritical(false),
+   iDelayMillis(0),
    iSocket(iIOService) {
   udp::resolver resolver(iIOService);
   udp::resolver::query query(udp::v4(), utf_to_utf<char>(hostname), utf_to_utf<char>(port));
@@ -34,22 +35,97 @@ UdpSocket::UdpSocket(const std::u16string& hostname, const std::u16string& port)
   iSocket.open(udp::v4());
 }
 
-UdpSocket::~UdpSocket() {
+/*
+ * Subclasses that provide their own transport use this constructor; the UDP
+ * socket is left closed and no UDP endpoint is resolved.
+ */
+UdpSocket::UdpSocket(const std::u16string& hostname, const std::u16string& port, size_t maxPacketSize, PacketPool* pool)
+ : iHostname(hostname),
+   iPort(port),
+   iMaxPacketSize(maxPacketSize),
+   iOwnPool(pool ? 0 : PacketPool::MAX_BUFFER_SIZE, maxPacketSize),
+   iPool(pool ? pool : &iOwnPool),
+   iPacket(NULL),
+   iScheduler(NULL),
+   iCritical(false),
+   iDelayMillis(0),
+   iSocket(iIOService) {
+}
 
+/*
+ * Anything still batched is discarded, as before; callers flush() first if
+ * they want it sent.
+ */
+UdpSocket::~UdpSocket() {
+  if (iPacket != NULL) {
+    iPool->release(iPacket);
+  }
 }
 
+/*
+ * Add the data to the current packet, sending the packet first if the data
+ * will not fit. A packet never outgrows a pool buffer, even while the pool is
+ * still sized for another transport. A single line longer than the packet size is still sent on
+ * its own, up to the size of a pool buffer (the packet size rounded up to
+ * whole cache lines); a longer line is dropped and counted by the pool. If no
+ * buffer is available from the pool, even after shedding a queued packet,
+ * then the data is dropped.
+ */
 void UdpSocket::send(const std::string& data) 
 {
-  if ((iBuffer.length() + 1 + data.length()) > UDP_MAX_PACKET_SIZE) {
+  if (data.length() > iPool->bufferSize()) {
+    iPool->dropOversized();
+    return;
+  }
+  size_t packetSize = std::min(iMaxPacketSize, iPool->bufferSize());
+  if (iPacket != NULL && (iPacket->iLength + 1 + data.length()) > packetSize) {
     flush();
   }
-  if (!iBuffer.empty()) {
-    iBuffer += u'\n';
+  if (iPacket == NULL) {
+    /*
+     * Buffers of packets the scheduler has sent may not have been given back
+     * yet; failing that, make room by shedding a queued packet.
+     */
+    if (iScheduler != NULL && iPool->inUse() == iPool->bufferCount()) {
+      iScheduler->reclaim();
+      if (iPool->inUse() == iPool->bufferCount()) {
+        iScheduler->shed(iPool, iCritical);
+      }
+    }
+    iPacket = iPool->acquire();
+    if (iPacket == NULL) {
+      return;
+    }
   }
-  iBuffer += data;
+  if (iPacket->iLength != 0) {
+    iPacket->iData[iPacket->iLength++] = '\n';
+  }
+  memcpy(iPacket->iData + iPacket->iLength, data.data(), data.length());
+  iPacket->iLength += data.length();
 }
 
 void UdpSocket::flush() {
-  iSocket.send_to(boost::asio::buffer(iBuffer), iEndpoint);
-  iBuffer.clear();
+  if (iPacket == NULL) {
+    return;
+  }
+  if (iPacket->iLength != 0 && iScheduler != NULL && iScheduler->running()) {
+    iScheduler->submit(this, iPacket, iCritical, iDelayMillis);
+    iPacket = NULL;
+    return;
+  }
+  if (iPacket->iLength != 0 && !transmit(iPacket->iData, iPacket->iLength) && iScheduler != NULL) {
+    iScheduler->transmitFailed();
+  }
+  iPool->release(iPacket);
+  iPacket = NULL;
+}
+
+/*
+ * Send errors, such as no route to the host, are reported rather than thrown,
+ * because this also runs on the scheduler's sending thread.
+ */
+bool UdpSocket::transmit(const char* packet, size_t length) {
+  boost::system::error_code error;
+  iSocket.send_to(boost::asio::buffer(packet, length), iEndpoint, 0, error);
+  return !error;
 }
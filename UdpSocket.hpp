@@ -10,6 +10,9 @@
 #ifndef UdpSocket_hpp
 #define UdpSocket_hpp
 
+#include "PacketPool.hpp"
+#include "SendScheduler.hpp"
+
 #include <boost/asio.hpp>
 #include <string>
 
@@ -21,17 +24,43 @@ class UdpSocket {
 
 public:
 
-  UdpSocket(const std::u16string& hostname, const std::u16string& port);
+  // Packets are batched in buffers from the pool if given, otherwise in a
+  // small pool owned by this socket.
+  UdpSocket(const std::u16string& hostname, const std::u16string& port, PacketPool* pool = NULL);
   virtual ~UdpSocket();
 
   virtual void send(const std::string& data);
   virtual void flush();
 
+  // Packets are paced by the scheduler, if set, once it is running.
+  void setScheduler(SendScheduler* scheduler) { iScheduler = scheduler; }
+
+  // How packets flushed for the current record are scheduled.
+  void schedule(bool critical, uint32_t delayMillis) { iCritical = critical; iDelayMillis = delayMillis; }
+
+  // This is apparently the safest UDP packet size, suitable for transmission
+  // across the internet. I suspect it's overkill and can be increased.
+  static const size_t MAX_PACKET_SIZE = 508;
+
 protected:
 
+  friend class SendScheduler;
+
+  // For subclasses that carry each batch over a different transport.
+  UdpSocket(const std::u16string& hostname, const std::u16string& port, size_t maxPacketSize, PacketPool* pool);
+
+  // Returns false if the packet could not be sent; the packet is then lost.
+  virtual bool transmit(const char* packet, size_t length);
+
   std::u16string iHostname;
   std::u16string iPort;
-  std::string iBuffer;
+  size_t iMaxPacketSize;
+  PacketPool iOwnPool;
+  PacketPool* iPool;
+  PacketBuffer* iPacket;
+  SendScheduler* iScheduler;
+  bool iCritical;
+  uint32_t iDelayMillis;
 
   boost::asio::io_service iIOService;
   boost::asio::ip::udp::endpoint iEndpoint;
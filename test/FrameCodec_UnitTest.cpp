@@ -0,0 +1,84 @@
+/********************************************************* {COPYRIGHT-TOP} ***
+* Copyright 2017 IBM Corporation
+*
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the MIT License
+* which accompanies this distribution, and is available at
+* http://opensource.org/licenses/MIT
+********************************************************** {COPYRIGHT-END} **/
+
+
+#include "FrameCodec.hpp" //! Product code
+
+#include <gmock/gmock.h> //! gtest/gmock support
+using namespace ::testing;
+
+#include <stdexcept>
+#include <vector>
+
+/** 
+ *  Test: Lines sharing a long prefix survive a round trip and the
+ *        shared prefix is only sent once.
+ */
+TEST(FrameCodec_UnitTest, roundTripElidesSharedPrefix)
+{
+  std::vector<std::string> lines;
+  lines.push_back("host.node.server.app.lib.flow.minimumCPUTime:0.000000|g");
+  lines.push_back("host.node.server.app.lib.flow.maximumCPUTime:0.000000|g");
+  lines.push_back("");
+  lines.push_back("other.metric:1|c");
+
+  FrameEncoder encoder;
+  size_t plainLength = 0;
+  for (size_t i = 0; i < lines.size(); ++i) {
+    encoder.append(lines[i]);
+    plainLength += lines[i].length() + 1;
+  }
+  const std::string& frame = encoder.finish();
+  EXPECT_LT(frame.length(), plainLength);
+
+  // Feed one byte at a time to exercise reassembly across reads.
+  FrameDecoder decoder;
+  std::vector<std::string> decoded;
+  std::string line;
+  for (size_t i = 0; i < frame.length(); ++i) {
+    decoder.feed(frame.data() + i, 1);
+    while (decoder.next(line)) {
+      decoded.push_back(line);
+    }
+  }
+  EXPECT_EQ(lines, decoded);
+}
+
+/** 
+ *  Test: Each frame is decoded independently of the previous one.
+ */
+TEST(FrameCodec_UnitTest, framesAreIndependent)
+{
+  FrameEncoder encoder;
+  encoder.append("a.b.c:1|g");
+  std::string stream = encoder.finish();
+  encoder.reset();
+  EXPECT_TRUE(encoder.empty());
+  encoder.append("a.b.d:2|g");
+  stream += encoder.finish();
+
+  FrameDecoder decoder;
+  decoder.feed(stream.data(), stream.length());
+  std::string line;
+  ASSERT_TRUE(decoder.next(line));
+  EXPECT_EQ("a.b.c:1|g", line);
+  ASSERT_TRUE(decoder.next(line));
+  EXPECT_EQ("a.b.d:2|g", line);
+  EXPECT_FALSE(decoder.next(line));
+}
+
+/** 
+ *  Test: A prefix longer than the previous line is rejected.
+ */
+TEST(FrameCodec_UnitTest, corruptFrameThrows)
+{
+  const char frame[] = { 0, 0, 0, 3, 5, 1, 'x' };
+  FrameDecoder decoder;
+  EXPECT_THROW(decoder.feed(frame, sizeof(frame)), std::runtime_error);
+}
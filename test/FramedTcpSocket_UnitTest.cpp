@@ -0,0 +1,93 @@
+/********************************************************* {COPYRIGHT-TOP} ***
+* Copyright 2017 IBM Corporation
+*
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the MIT License
+* which accompanies this distribution, and is available at
+* http://opensource.org/licenses/MIT
+********************************************************** {COPYRIGHT-END} **/
+
+
+#include "FramedTcpSocket.hpp" //! Product code
+
+#include <gmock/gmock.h> //! gtest/gmock support
+#include <boost/locale.hpp>
+using namespace ::testing;
+using boost::asio::ip::tcp;
+using boost::locale::conv::utf_to_utf;
+
+//!
+//! Makes transmit() callable, so that batches can be sent without a pool.
+//!
+class TestFramedTcpSocket : public FramedTcpSocket {
+public:
+  TestFramedTcpSocket(unsigned short port)
+  : FramedTcpSocket(u"127.0.0.1", portString(port))
+  {
+  }
+
+  using FramedTcpSocket::transmit;
+
+  static std::u16string portString(unsigned short port)
+  {
+    std::string digits = std::to_string(port);
+    return utf_to_utf<char16_t>(digits);
+  }
+};
+
+/**
+ *  Test: A batch is sent to the relay as one frame that decodes back into
+ *        the original lines.
+ */
+TEST(FramedTcpSocket_UnitTest, frameReachesRelay)
+{
+  boost::asio::io_service service;
+  tcp::acceptor acceptor(service, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+  TestFramedTcpSocket socket(acceptor.local_endpoint().port());
+
+  std::string batch("a.b:1.000000|g\na.c:2.000000|g");
+  EXPECT_TRUE(socket.transmit(batch.data(), batch.length()));
+
+  tcp::socket relay(service);
+  acceptor.accept(relay);
+  char buffer[256];
+  size_t length = relay.read_some(boost::asio::buffer(buffer));
+
+  FrameDecoder decoder;
+  decoder.feed(buffer, length);
+  std::string line;
+  ASSERT_TRUE(decoder.next(line));
+  EXPECT_EQ("a.b:1.000000|g", line);
+  ASSERT_TRUE(decoder.next(line));
+  EXPECT_EQ("a.c:2.000000|g", line);
+}
+
+/**
+ *  Test: After a failed connect, the next batch does not try to connect
+ *        again until the back-off delay has passed.
+ */
+TEST(FramedTcpSocket_UnitTest, failedConnectBacksOff)
+{
+  boost::asio::io_service service;
+  tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), 0);
+  unsigned short port = 0;
+  {
+    tcp::acceptor unused(service, endpoint);
+    port = unused.local_endpoint().port();
+  }
+  TestFramedTcpSocket socket(port);
+
+  // Nothing is listening, so the connection is refused.
+  std::string batch("a.b:1.000000|g");
+  EXPECT_FALSE(socket.transmit(batch.data(), batch.length()));
+
+  endpoint.port(port);
+  tcp::acceptor acceptor(service, endpoint);
+  acceptor.non_blocking(true);
+  EXPECT_FALSE(socket.transmit(batch.data(), batch.length()));
+
+  tcp::socket relay(service);
+  boost::system::error_code error;
+  acceptor.accept(relay, error);
+  EXPECT_EQ(boost::asio::error::would_block, error);
+}
@@ -0,0 +1,51 @@
+/********************************************************* {COPYRIGHT-TOP} ***
+* Copyright 2017 IBM Corporation
+*
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the MIT License
+* which accompanies this distribution, and is available at
+* http://opensource.org/licenses/MIT
+********************************************************** {COPYRIGHT-END} **/
+
+
+#include "PacketPool.hpp" //! Product code
+
+#include <gmock/gmock.h> //! gtest/gmock support
+using namespace ::testing;
+
+/** 
+ *  Test: The pool hands out aligned buffers up to its memory limit, counts
+ *        exhaustion, and recycles released buffers.
+ */
+TEST(PacketPool_UnitTest, boundedAndRecycled)
+{
+  // 508 byte packets are rounded up to whole cache lines.
+  PacketPool pool((2 * 512) + 100, 508);
+  EXPECT_EQ(512u, pool.bufferSize());
+  EXPECT_EQ(2u, pool.bufferCount());
+
+  PacketBuffer* first = pool.acquire();
+  PacketBuffer* second = pool.acquire();
+  ASSERT_THAT(first, NotNull());
+  ASSERT_THAT(second, NotNull());
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(first->iData) % PacketPool::CACHE_LINE_SIZE);
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(second->iData) % PacketPool::CACHE_LINE_SIZE);
+  EXPECT_THAT(pool.acquire(), IsNull());
+  EXPECT_EQ(1u, pool.exhausted());
+  EXPECT_EQ(2u, pool.inUse());
+
+  second->iLength = 10;
+  pool.release(second);
+  PacketBuffer* third = pool.acquire();
+  EXPECT_EQ(second, third);
+  EXPECT_EQ(0u, third->iLength);
+  EXPECT_EQ(2u, pool.highWater());
+
+  // Buffers are still in use, so the pool cannot be reallocated.
+  EXPECT_FALSE(pool.resize(PacketPool::MAX_BUFFER_SIZE, PacketPool::MAX_BUFFER_SIZE));
+  pool.release(first);
+  pool.release(third);
+  EXPECT_TRUE(pool.resize(PacketPool::MAX_BUFFER_SIZE, PacketPool::MAX_BUFFER_SIZE));
+  EXPECT_EQ(PacketPool::MAX_BUFFER_SIZE, pool.bufferSize());
+  EXPECT_EQ(1u, pool.bufferCount());
+}
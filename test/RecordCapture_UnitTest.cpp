@@ -0,0 +1,125 @@
+/********************************************************* {COPYRIGHT-TOP} ***
+* Copyright 2017 IBM Corporation
+*
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the MIT License
+* which accompanies this distribution, and is available at
+* http://opensource.org/licenses/MIT
+********************************************************** {COPYRIGHT-END} **/
+
+
+#include "RecordCapture.hpp"     //! Product code
+#include "StatsdStatsWriter.hpp" //! Product code
+
+#include <gmock/gmock.h> //! gtest/gmock support
+using namespace ::testing;
+
+#include <cstdio>
+
+//! Fixture providing a populated record and a scratch capture file.
+class RecordCapture_UnitTest: public ::testing::Test 
+{
+public:
+
+  RecordCapture_UnitTest()
+  : iPath("RecordCapture_UnitTest.cap")
+  {
+    std::remove(iPath.c_str());
+    memset((void *)&iRecord, 0, sizeof(iRecord));
+    iRecord.version = CSI_STATS_RECORD_VERSION_1;
+    iRecord.type = CSI_STATS_RECORD_TYPE_ARCHIVE;
+    iRecord.code = CSI_STATS_RECORD_CODE_MAJOR_INTERVAL;
+    iRecord.messageFlow.brokerLabel = u"node";
+    iRecord.messageFlow.executionGroupName = u"server";
+    iRecord.messageFlow.messageFlowName = u"flow";
+    iRecord.messageFlow.applicationName = u"他们";
+    iRecord.messageFlow.startDate.year = 116;
+    iRecord.messageFlow.startTime.second = 12.5f;
+    iRecord.messageFlow.endTime.minute = 59;
+    iRecord.messageFlow.minimumCPUTime = -1;
+    iRecord.messageFlow.totalInputMessages = 123456789;
+  }
+
+  ~RecordCapture_UnitTest()
+  {
+    std::remove(iPath.c_str());
+  }
+
+  std::string    iPath;
+  CsiStatsRecord iRecord;
+};
+
+/** 
+ *  Test: Records captured through the captureFile property read back
+ *        with the same contents, across capture sessions.
+ */
+TEST_F(RecordCapture_UnitTest, captureAndReadBack)
+{
+  {
+    StatsdStatsWriter testStatsdStatsWriter;
+    int rc = CCI_FAILURE;
+    testStatsdStatsWriter.setAttribute(&rc, u"captureFile", u"RecordCapture_UnitTest.cap");
+    EXPECT_EQ(CCI_SUCCESS, rc);
+    testStatsdStatsWriter.write(&iRecord);
+    testStatsdStatsWriter.write(&iRecord);
+  }
+  {
+    // A second session appends to the file with its own string table.
+    CaptureWriter capture(iPath);
+    ASSERT_TRUE(capture.good());
+    iRecord.messageFlow.messageFlowName = u"other";
+    capture.write(&iRecord, 42);
+  }
+
+  CaptureReader reader(iPath);
+  CsiStatsRecord record;
+  uint64_t elapsedMillis = 0;
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(reader.next(record, elapsedMillis));
+    EXPECT_EQ(CSI_STATS_RECORD_TYPE_ARCHIVE, record.type);
+    EXPECT_EQ(CSI_STATS_RECORD_CODE_MAJOR_INTERVAL, record.code);
+    EXPECT_TRUE(std::u16string(u"node") == record.messageFlow.brokerLabel);
+    EXPECT_TRUE(std::u16string(u"他们") == record.messageFlow.applicationName);
+    EXPECT_THAT(record.messageFlow.libraryName, IsNull());
+    EXPECT_EQ(116, record.messageFlow.startDate.year);
+    EXPECT_EQ(12.5f, record.messageFlow.startTime.second);
+    EXPECT_EQ(59, record.messageFlow.endTime.minute);
+    EXPECT_EQ(-1, record.messageFlow.minimumCPUTime);
+    EXPECT_EQ(123456789, record.messageFlow.totalInputMessages);
+  }
+  EXPECT_TRUE(std::u16string(u"other") == record.messageFlow.messageFlowName);
+  EXPECT_EQ(42u, elapsedMillis);
+  EXPECT_FALSE(reader.next(record, elapsedMillis));
+}
+
+extern int cciLogCount;
+
+/** 
+ *  Test: A capture file that cannot be opened or written is logged once,
+ *        rather than capture stopping silently.
+ */
+TEST_F(RecordCapture_UnitTest, captureFailureIsLogged)
+{
+  StatsdStatsWriter testStatsdStatsWriter;
+  int rc = CCI_FAILURE;
+  testStatsdStatsWriter.setAttribute(&rc, u"captureFile", u"no-such-directory/capture.cap");
+  EXPECT_EQ(CCI_SUCCESS, rc);
+
+  int logged = cciLogCount;
+  testStatsdStatsWriter.write(&iRecord);
+  EXPECT_EQ(logged + 1, cciLogCount);
+  testStatsdStatsWriter.write(&iRecord);
+  EXPECT_EQ(logged + 1, cciLogCount);
+
+  // Writes to /dev/full fail once they are flushed, where it exists.
+  std::FILE* full = std::fopen("/dev/full", "ab");
+  if (full == NULL) {
+    return;
+  }
+  std::fclose(full);
+  testStatsdStatsWriter.setAttribute(&rc, u"captureFile", u"/dev/full");
+  testStatsdStatsWriter.write(&iRecord);
+  EXPECT_EQ(logged + 2, cciLogCount);
+  testStatsdStatsWriter.write(&iRecord);
+  EXPECT_EQ(logged + 2, cciLogCount);
+}
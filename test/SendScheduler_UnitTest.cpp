@@ -0,0 +1,303 @@
+/********************************************************* {COPYRIGHT-TOP} ***
+* Copyright 2017 IBM Corporation
+*
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the MIT License
+* which accompanies this distribution, and is available at
+* http://opensource.org/licenses/MIT
+********************************************************** {COPYRIGHT-END} **/
+
+
+#include "SendScheduler.hpp" //! Product code
+#include "UdpSocket.hpp"
+
+#include <gmock/gmock.h> //! gtest/gmock support
+#include <string>
+#include <vector>
+using namespace ::testing;
+
+/**
+ *  Test: Critical flow patterns match whole unique flow names, with '?'
+ *        matching one character however many bytes it takes in UTF-8.
+ */
+TEST(SendScheduler_UnitTest, criticalFlowPatterns)
+{
+  struct Case { const char* pattern; const char* name; bool matches; };
+  const Case cases[] = {
+    { "Payments.*",  "Payments.Lib.Transfer", true },
+    { "Payments.*",  "Pay.Lib.Transfer",      false },
+    { "*.Audit?",    "App.Lib.Audit1",        true },
+    { "*.Audit?",    "App.Lib.Audit",         false },
+    { "*.Audit?",    "App.Lib.Audit12",       false },
+    { "App.?.Flow",  "App.\xC3\xA9.Flow",     true },
+    { "A.B",         "A.BC",                  false },
+    { "*",           "",                      true },
+    { "*",           "A*B",                   true },
+    { "*B*",         "AB*C",                  true },
+    { "",            "A",                     false }
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+    std::string name(cases[i].name);
+    EXPECT_EQ(cases[i].matches, SendScheduler::matchesPattern(cases[i].pattern, name.data(), name.length()))
+      << cases[i].pattern << " against " << cases[i].name;
+  }
+}
+
+/**
+ *  Test: Each flow keeps the same jitter offset, within the window, and
+ *        different flows are spread across the window.
+ */
+TEST(SendScheduler_UnitTest, jitterOffsetStableAndSpread)
+{
+  std::string name("App.Lib.Flow");
+  uint32_t offset = SendScheduler::jitterOffset(name.data(), name.length(), 1000);
+  EXPECT_EQ(offset, SendScheduler::jitterOffset(name.data(), name.length(), 1000));
+  EXPECT_EQ(0u, SendScheduler::jitterOffset(name.data(), name.length(), 1));
+
+  // Flows whose names differ only in the last characters still land in every
+  // tenth of the window.
+  std::vector<int> tenths(10, 0);
+  for (int i = 0; i < 100; ++i) {
+    std::string flow("App.Lib.Flow" + std::string(1, static_cast<char>('0' + (i / 10))) + static_cast<char>('0' + (i % 10)));
+    uint32_t flowOffset = SendScheduler::jitterOffset(flow.data(), flow.length(), 1000);
+    ASSERT_LT(flowOffset, 1000u);
+    ++tenths[flowOffset / 100];
+  }
+  for (size_t i = 0; i < tenths.size(); ++i) {
+    EXPECT_GT(tenths[i], 0) << "no flow in tenth " << i;
+  }
+}
+
+/*
+ * Pacing needs the sending thread, which is not built with AVOID_CXX11.
+ */
+#if !defined(AVOID_CXX11)
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+/*
+ * Records what the scheduler transmits instead of sending it anywhere.
+ */
+class RecordingSocket : public UdpSocket {
+
+public:
+
+  explicit RecordingSocket(PacketPool& pool)
+   : UdpSocket(u"localhost", u"8125", UdpSocket::MAX_PACKET_SIZE, &pool),
+     iFail(false),
+     iSendMillis(0),
+     iFinished(0) {
+  }
+
+  // Later packets take this long to send, as over a slow connection.
+  void slow(int millis) {
+    std::lock_guard<std::mutex> lock(iMutex);
+    iSendMillis = millis;
+  }
+
+  // Later packets are recorded, but reported as not sent.
+  void fail() {
+    std::lock_guard<std::mutex> lock(iMutex);
+    iFail = true;
+  }
+
+  std::vector<std::string> sent() {
+    std::lock_guard<std::mutex> lock(iMutex);
+    return iSent;
+  }
+
+  // The number of sends that have returned.
+  size_t finished() {
+    std::lock_guard<std::mutex> lock(iMutex);
+    return iFinished;
+  }
+
+protected:
+
+  virtual bool transmit(const char* data, size_t length) {
+    int sendMillis = 0;
+    bool fail = false;
+    {
+      std::lock_guard<std::mutex> lock(iMutex);
+      iSent.push_back(std::string(data, length));
+      sendMillis = iSendMillis;
+      fail = iFail;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(sendMillis));
+    std::lock_guard<std::mutex> lock(iMutex);
+    ++iFinished;
+    return !fail;
+  }
+
+private:
+
+  std::mutex iMutex;
+  bool iFail;
+  int iSendMillis;
+  size_t iFinished;
+  std::vector<std::string> iSent;
+
+};
+
+/**
+ *  Test: Packets beyond the packet rate budget are deferred, and critical
+ *        packets overtake ones that are waiting.
+ */
+TEST(SendScheduler_UnitTest, rateLimitedAndCriticalFirst)
+{
+  PacketPool pool(4 * 512, UdpSocket::MAX_PACKET_SIZE);
+  SendScheduler scheduler;
+  RecordingSocket socket(pool);
+  socket.setScheduler(&scheduler);
+  scheduler.configure(10, 0, 0);
+  ASSERT_TRUE(scheduler.running());
+
+  socket.schedule(false, 0);
+  socket.send("first:1|c");
+  socket.flush();
+  for (int i = 0; i < 100 && socket.sent().empty(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  socket.send("second:1|c");
+  socket.flush();
+  socket.schedule(true, 0);
+  socket.send("critical:1|c");
+  socket.flush();
+
+  // The burst allowed the first packet; each of the others waits a tenth of a second.
+  for (int i = 0; i < 100 && socket.sent().size() < 3; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  std::vector<std::string> sent(socket.sent());
+  ASSERT_EQ(3u, sent.size());
+  EXPECT_EQ("first:1|c", sent[0]);
+  EXPECT_EQ("critical:1|c", sent[1]);
+  EXPECT_EQ("second:1|c", sent[2]);
+  EXPECT_EQ(2u, scheduler.deferred());
+
+  scheduler.reclaim();
+  EXPECT_EQ(0u, pool.inUse());
+}
+
+/**
+ *  Test: When every buffer is queued, a new packet sheds the oldest queued
+ *        packet rather than being dropped, and drain() sends the rest at once.
+ */
+TEST(SendScheduler_UnitTest, shedWhenPoolFull)
+{
+  PacketPool pool(2 * 512, UdpSocket::MAX_PACKET_SIZE);
+  SendScheduler scheduler;
+  RecordingSocket socket(pool);
+  socket.setScheduler(&scheduler);
+  scheduler.configure(0, 0, 60000);
+
+  socket.schedule(false, 60000);
+  socket.send("old:1|c");
+  socket.flush();
+  socket.send("newer:1|c");
+  socket.flush();
+  socket.send("newest:1|c");
+  socket.flush();
+  EXPECT_EQ(1u, scheduler.shedCount());
+
+  scheduler.drain(&socket);
+  std::vector<std::string> sent(socket.sent());
+  ASSERT_EQ(2u, sent.size());
+  EXPECT_EQ("newer:1|c", sent[0]);
+  EXPECT_EQ("newest:1|c", sent[1]);
+}
+
+/**
+ *  Test: Packets that a socket fails to send are counted, both when they are
+ *        sent directly and from the sending thread, which keeps running.
+ */
+TEST(SendScheduler_UnitTest, failedSendsCounted)
+{
+  PacketPool pool(4 * 512, UdpSocket::MAX_PACKET_SIZE);
+  SendScheduler scheduler;
+  RecordingSocket socket(pool);
+  socket.setScheduler(&scheduler);
+  socket.fail();
+
+  socket.send("direct:1|c");
+  socket.flush();
+  EXPECT_EQ(1u, scheduler.failedCount());
+
+  scheduler.configure(0, 0, 1);
+  socket.schedule(false, 0);
+  socket.send("paced:1|c");
+  socket.flush();
+  socket.send("later:1|c");
+  socket.flush();
+  for (int i = 0; i < 100 && scheduler.failedCount() < 3; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(3u, socket.sent().size());
+  EXPECT_EQ(3u, scheduler.failedCount());
+}
+
+/**
+ *  Test: The scheduler is not locked while a packet is being sent, and
+ *        drain() waits for a send in flight to the socket before returning.
+ */
+TEST(SendScheduler_UnitTest, drainWaitsForSendInFlight)
+{
+  PacketPool pool(4 * 512, UdpSocket::MAX_PACKET_SIZE);
+  SendScheduler scheduler;
+  RecordingSocket socket(pool);
+  socket.setScheduler(&scheduler);
+  socket.slow(300);
+  scheduler.configure(0, 0, 1);
+
+  socket.schedule(false, 0);
+  socket.send("slow:1|c");
+  socket.flush();
+  for (int i = 0; i < 100 && socket.sent().empty(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT_EQ(1u, socket.sent().size());
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  scheduler.shedCount();
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(100));
+  EXPECT_EQ(0u, socket.finished());
+
+  scheduler.drain(&socket);
+  EXPECT_EQ(1u, socket.finished());
+}
+
+/**
+ *  Test: Packets delayed by jitter are sent in the order they fall due,
+ *        not the order they were flushed.
+ */
+TEST(SendScheduler_UnitTest, jitterOrdersSends)
+{
+  PacketPool pool(4 * 512, UdpSocket::MAX_PACKET_SIZE);
+  SendScheduler scheduler;
+  RecordingSocket socket(pool);
+  socket.setScheduler(&scheduler);
+  scheduler.configure(0, 0, 1000);
+
+  socket.schedule(false, 200);
+  socket.send("late:1|c");
+  socket.flush();
+  socket.schedule(false, 50);
+  socket.send("early:1|c");
+  socket.flush();
+  socket.schedule(true, 0);
+  socket.send("critical:1|c");
+  socket.flush();
+
+  for (int i = 0; i < 100 && socket.sent().size() < 3; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  std::vector<std::string> sent(socket.sent());
+  ASSERT_EQ(3u, sent.size());
+  EXPECT_EQ("critical:1|c", sent[0]);
+  EXPECT_EQ("early:1|c", sent[1]);
+  EXPECT_EQ("late:1|c", sent[2]);
+}
+
+#endif
@@ -17,6 +17,10 @@ using namespace ::testing;
 
 #include <boost/asio/ip/host_name.hpp>
 #include <boost/locale.hpp>
+#if !defined(AVOID_CXX11)
+# include <chrono>
+# include <thread>
+#endif
 using boost::locale::conv::utf_to_utf;
 using namespace boost::asio::ip; //! host_name()
 
@@ -152,3 +156,383 @@ TEST_F(StatsdStatsWriter_UnitTest, udpSocketWriteWithUnicode)
   //
   // Data validation errors will have been flagged already in fakeSend().
 }
+
+/** 
+ *  Test: Check archive records are written under the archive namespace
+ *        so that they do not overwrite the snapshot metrics.
+ */
+TEST_F(StatsdStatsWriter_UnitTest, archiveRecordUsesArchiveNamespace)
+{
+  iRecord.type = CSI_STATS_RECORD_TYPE_ARCHIVE;
+  iRecord.code = CSI_STATS_RECORD_CODE_MAJOR_INTERVAL;
+
+  std::string    hostname(host_name()); // Taken from StatsStatsWriter.cpp
+  hostname = hostname.substr(0, hostname.find('.'));
+  std::string    expectedData = "archive." + hostname + ".dummyBroker.b.f.h.d.minimumCPUTime:0.000000|g";
+
+  StrictMock<FakeUdpSocket> *fakeUdp = new StrictMock<FakeUdpSocket>(u"localhost", u"65535", expectedData);
+  StatsdStatsWriter testStatsdStatsWriter(fakeUdp); // The stats writer will free the mock
+
+  EXPECT_CALL(*fakeUdp, send(_)).Times(7)
+    .WillOnce(Invoke(fakeUdp, &FakeUdpSocket::fakeSend))
+    .WillRepeatedly(Return());
+
+  EXPECT_CALL(*fakeUdp, flush());
+
+  testStatsdStatsWriter.write(&iRecord);
+}
+
+/** 
+ *  Test: Check archive records are dropped, not sent to the snapshot
+ *        destination, while the archive destination cannot be resolved.
+ */
+TEST_F(StatsdStatsWriter_UnitTest, unresolvedArchiveDestinationDropsArchiveRecords)
+{
+  iRecord.type = CSI_STATS_RECORD_TYPE_ARCHIVE;
+  iRecord.code = CSI_STATS_RECORD_CODE_MAJOR_INTERVAL;
+
+  StrictMock<FakeUdpSocket> *fakeUdp = new StrictMock<FakeUdpSocket>(u"localhost", u"65535", "");
+  StatsdStatsWriter testStatsdStatsWriter(fakeUdp); // The stats writer will free the mock
+
+  int rc = CCI_FAILURE;
+  testStatsdStatsWriter.setAttribute(&rc, u"archiveHostname", u"no-such-host.invalid");
+  EXPECT_EQ(CCI_SUCCESS, rc);
+
+  // Nothing is sent to or flushed on the snapshot socket.
+  testStatsdStatsWriter.write(&iRecord);
+}
+
+/** 
+ *  Test: Check the snapshot and archive metric selections are applied
+ *        independently, and that unknown metric names are rejected.
+ */
+TEST_F(StatsdStatsWriter_UnitTest, metricSelectionPerRecordType)
+{
+  std::string    hostname(host_name()); // Taken from StatsStatsWriter.cpp
+  hostname = hostname.substr(0, hostname.find('.'));
+  std::string    expectedData = "snap." + hostname + ".dummyBroker.b.f.h.d.averageMessageRate:0.000000|g";
+
+  StrictMock<FakeUdpSocket> *fakeUdp = new StrictMock<FakeUdpSocket>(u"localhost", u"65535", expectedData);
+  StatsdStatsWriter testStatsdStatsWriter(fakeUdp); // The stats writer will free the mock
+
+  int rc = CCI_FAILURE;
+  testStatsdStatsWriter.setAttribute(&rc, u"snapshotNamespace", u"snap");
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  testStatsdStatsWriter.setAttribute(&rc, u"snapshotMetrics", u"averageMessageRate,maximumCPUTime");
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  testStatsdStatsWriter.setAttribute(&rc, u"archiveMetrics", u"none");
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  testStatsdStatsWriter.setAttribute(&rc, u"archiveMetrics", u"noSuchMetric");
+  EXPECT_EQ(CCI_FAILURE, rc);
+
+  CciChar buffer[64];
+  CciSize length = testStatsdStatsWriter.getAttribute(&rc, u"archiveMetrics", buffer, 64);
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  EXPECT_TRUE(std::u16string(u"none") == std::u16string(buffer, length));
+
+  // maximumCPUTime is written first; only validate averageMessageRate.
+  EXPECT_CALL(*fakeUdp, send(_)).Times(2)
+    .WillOnce(Return())
+    .WillOnce(Invoke(fakeUdp, &FakeUdpSocket::fakeSend));
+
+  EXPECT_CALL(*fakeUdp, flush());
+
+  testStatsdStatsWriter.write(&iRecord);
+
+  // Archive records are switched off entirely.
+  iRecord.type = CSI_STATS_RECORD_TYPE_ARCHIVE;
+  testStatsdStatsWriter.write(&iRecord);
+}
+
+/** 
+ *  Test: Check property changes are staged until the next record, and
+ *        that the old socket is flushed before it is replaced.
+ */
+TEST_F(StatsdStatsWriter_UnitTest, destinationChangeAppliedOnWrite)
+{
+  StrictMock<FakeUdpSocket> *fakeUdp = new StrictMock<FakeUdpSocket>(u"localhost", u"65535", "");
+  StatsdStatsWriter testStatsdStatsWriter(fakeUdp); // The stats writer will free the mock
+
+  int rc = CCI_FAILURE;
+  testStatsdStatsWriter.setAttribute(&rc, u"port", u"notaport");
+  EXPECT_EQ(CCI_FAILURE, rc);
+  testStatsdStatsWriter.setAttribute(&rc, u"port", u"65536");
+  EXPECT_EQ(CCI_FAILURE, rc);
+
+  // Nothing is sent to or flushed on the mock while changes are staged.
+  testStatsdStatsWriter.setAttribute(&rc, u"hostname", u"localhost");
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  testStatsdStatsWriter.setAttribute(&rc, u"port", u"65535");
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  Mock::VerifyAndClearExpectations(fakeUdp);
+
+  // The next record flushes and replaces the mock with a real socket, and
+  // is sent through the real socket rather than the mock.
+  EXPECT_CALL(*fakeUdp, flush());
+  testStatsdStatsWriter.write(&iRecord);
+}
+
+/** 
+ *  Test: Check a port or protocol change with no hostname keeps the socket
+ *        passed to the constructor, and that the metric host name can be
+ *        pinned.
+ */
+TEST_F(StatsdStatsWriter_UnitTest, socketKeptWithoutHostname)
+{
+  std::string    expectedData = "pinned.dummyBroker.b.f.h.d.minimumCPUTime:0.000000|g";
+
+  StrictMock<FakeUdpSocket> *fakeUdp = new StrictMock<FakeUdpSocket>(u"localhost", u"65535", expectedData);
+  StatsdStatsWriter testStatsdStatsWriter(fakeUdp); // The stats writer will free the mock
+  testStatsdStatsWriter.setMetricHostname("pinned.example.com");
+
+  int rc = CCI_FAILURE;
+  testStatsdStatsWriter.setAttribute(&rc, u"port", u"9999");
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  testStatsdStatsWriter.setAttribute(&rc, u"protocol", u"tcp-framed");
+  EXPECT_EQ(CCI_SUCCESS, rc);
+
+  // The protocol change reallocates the packet buffers, so the mock is
+  // flushed first, and then the record still goes to the mock.
+  EXPECT_CALL(*fakeUdp, send(_)).Times(7)
+    .WillOnce(Invoke(fakeUdp, &FakeUdpSocket::fakeSend))
+    .WillRepeatedly(Return());
+
+  EXPECT_CALL(*fakeUdp, flush()).Times(2);
+
+  testStatsdStatsWriter.write(&iRecord);
+}
+
+/** 
+ *  Test: Check the memory limit is validated and applied to the packet
+ *        buffers, and that the buffer statistics are read-only.
+ */
+TEST_F(StatsdStatsWriter_UnitTest, memoryLimitSizesPacketBuffers)
+{
+  StatsdStatsWriter testStatsdStatsWriter;
+
+  int rc = CCI_FAILURE;
+  testStatsdStatsWriter.setAttribute(&rc, u"memoryLimit", u"100");
+  EXPECT_EQ(CCI_FAILURE, rc);
+  testStatsdStatsWriter.setAttribute(&rc, u"memoryLimit", u"16384");
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  testStatsdStatsWriter.setAttribute(&rc, u"packetBuffers", u"4");
+  EXPECT_EQ(CCI_FAILURE, rc);
+
+  // The limit is applied with the next record, as 512 byte UDP packet buffers.
+  testStatsdStatsWriter.write(&iRecord);
+
+  CciChar buffer[64];
+  CciSize length = testStatsdStatsWriter.getAttribute(&rc, u"packetBuffers", buffer, 64);
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  EXPECT_TRUE(std::u16string(u"32") == std::u16string(buffer, length));
+  length = testStatsdStatsWriter.getAttribute(&rc, u"packetBuffersInUse", buffer, 64);
+  EXPECT_TRUE(std::u16string(u"0") == std::u16string(buffer, length));
+}
+
+/** 
+ *  Test: Check a metric line longer than a packet buffer is dropped and
+ *        counted, rather than lost silently.
+ */
+TEST_F(StatsdStatsWriter_UnitTest, oversizedMetricsAreCounted)
+{
+  StatsdStatsWriter testStatsdStatsWriter;
+
+  int rc = CCI_FAILURE;
+  testStatsdStatsWriter.setAttribute(&rc, u"hostname", u"127.0.0.1");
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  testStatsdStatsWriter.setAttribute(&rc, u"port", u"65535");
+  EXPECT_EQ(CCI_SUCCESS, rc);
+
+  // 200 characters of 3 bytes each in UTF-8 make every line longer than 512 bytes.
+  std::u16string longName(200, char16_t(0x4E2D));
+  iRecord.messageFlow.messageFlowName = longName.c_str();
+  testStatsdStatsWriter.write(&iRecord);
+
+  CciChar buffer[64];
+  CciSize length = testStatsdStatsWriter.getAttribute(&rc, u"packetBuffersOversized", buffer, 64);
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  EXPECT_TRUE(std::u16string(u"7") == std::u16string(buffer, length));
+  length = testStatsdStatsWriter.getAttribute(&rc, u"packetBuffersExhausted", buffer, 64);
+  EXPECT_TRUE(std::u16string(u"0") == std::u16string(buffer, length));
+}
+
+/** 
+ *  Test: The send pacing properties are validated, and the scheduler counters
+ *        are read-only.
+ */
+TEST_F(StatsdStatsWriter_UnitTest, sendPacingProperties)
+{
+  StatsdStatsWriter testStatsdStatsWriter;
+
+  int rc = CCI_FAILURE;
+  testStatsdStatsWriter.setAttribute(&rc, u"sendJitter", u"60001");
+  EXPECT_EQ(CCI_FAILURE, rc);
+  testStatsdStatsWriter.setAttribute(&rc, u"sendPacketRate", u"fast");
+  EXPECT_EQ(CCI_FAILURE, rc);
+  testStatsdStatsWriter.setAttribute(&rc, u"sendPacketRate", u"0");
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  testStatsdStatsWriter.setAttribute(&rc, u"criticalFlows", u"Payments.*,*.Audit?");
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  testStatsdStatsWriter.setAttribute(&rc, u"sendShed", u"0");
+  EXPECT_EQ(CCI_FAILURE, rc);
+
+  CciChar buffer[64];
+  CciSize length = testStatsdStatsWriter.getAttribute(&rc, u"criticalFlows", buffer, 64);
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  EXPECT_TRUE(std::u16string(u"Payments.*,*.Audit?") == std::u16string(buffer, length));
+  length = testStatsdStatsWriter.getAttribute(&rc, u"sendDeferred", buffer, 64);
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  EXPECT_TRUE(std::u16string(u"0") == std::u16string(buffer, length));
+}
+
+#if !defined(AVOID_CXX11)
+/** 
+ *  Test: With the default memory limit, a burst of records that must wait
+ *        for the packet rate is queued rather than shed.
+ */
+TEST_F(StatsdStatsWriter_UnitTest, pacedBurstFitsDefaultMemoryLimit)
+{
+  StatsdStatsWriter testStatsdStatsWriter;
+
+  int rc = CCI_FAILURE;
+  testStatsdStatsWriter.setAttribute(&rc, u"hostname", u"127.0.0.1");
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  testStatsdStatsWriter.setAttribute(&rc, u"port", u"65535");
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  testStatsdStatsWriter.setAttribute(&rc, u"sendPacketRate", u"1000");
+  EXPECT_EQ(CCI_SUCCESS, rc);
+
+  for (int i = 0; i < 300; ++i) {
+    testStatsdStatsWriter.write(&iRecord);
+  }
+
+  // The counters are published with each record.
+  CciChar buffer[64];
+  CciSize length = 0;
+  for (int i = 0; i < 100; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    testStatsdStatsWriter.write(&iRecord);
+    length = testStatsdStatsWriter.getAttribute(&rc, u"sendDeferred", buffer, 64);
+    if (std::u16string(u"0") != std::u16string(buffer, length)) {
+      break;
+    }
+  }
+  EXPECT_TRUE(std::u16string(u"0") != std::u16string(buffer, length));
+  length = testStatsdStatsWriter.getAttribute(&rc, u"sendShed", buffer, 64);
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  EXPECT_TRUE(std::u16string(u"0") == std::u16string(buffer, length));
+}
+
+/** 
+ *  Test: Packets from a socket passed to the constructor, which batches in
+ *        its own pool, go back to that pool when they are paced, and the
+ *        writer's buffers are not affected.
+ */
+TEST_F(StatsdStatsWriter_UnitTest, pacedInjectedSocketKeepsItsOwnPool)
+{
+  StatsdStatsWriter testStatsdStatsWriter(new UdpSocket(u"127.0.0.1", u"65535"));
+
+  int rc = CCI_FAILURE;
+  testStatsdStatsWriter.setAttribute(&rc, u"sendPacketRate", u"1000");
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  for (int i = 0; i < 50; ++i) {
+    testStatsdStatsWriter.write(&iRecord);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  CciChar buffer[64];
+  CciSize length = testStatsdStatsWriter.getAttribute(&rc, u"packetBuffersInUse", buffer, 64);
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  EXPECT_TRUE(std::u16string(u"0") == std::u16string(buffer, length));
+  length = testStatsdStatsWriter.getAttribute(&rc, u"packetBuffersHighWater", buffer, 64);
+  EXPECT_TRUE(std::u16string(u"0") == std::u16string(buffer, length));
+}
+/** 
+ *  Test: A rejected send rate leaves the staged rate unchanged, so it does
+ *        not take effect when a later property is accepted.
+ */
+TEST_F(StatsdStatsWriter_UnitTest, rejectedSendRateNotApplied)
+{
+  StatsdStatsWriter testStatsdStatsWriter;
+
+  int rc = CCI_SUCCESS;
+  testStatsdStatsWriter.setAttribute(&rc, u"sendPacketRate", u"5x");
+  EXPECT_EQ(CCI_FAILURE, rc);
+  testStatsdStatsWriter.setAttribute(&rc, u"sendByteRate", u"5000000000");
+  EXPECT_EQ(CCI_FAILURE, rc);
+  testStatsdStatsWriter.setAttribute(&rc, u"hostname", u"127.0.0.1");
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  testStatsdStatsWriter.setAttribute(&rc, u"port", u"65535");
+  EXPECT_EQ(CCI_SUCCESS, rc);
+
+  // At 5 packets a second, the second packet would have to wait.
+  for (int i = 0; i < 10; ++i) {
+    testStatsdStatsWriter.write(&iRecord);
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  testStatsdStatsWriter.write(&iRecord);
+
+  CciChar buffer[64];
+  CciSize length = testStatsdStatsWriter.getAttribute(&rc, u"sendDeferred", buffer, 64);
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  EXPECT_TRUE(std::u16string(u"0") == std::u16string(buffer, length));
+  length = testStatsdStatsWriter.getAttribute(&rc, u"sendPacketRate", buffer, 64);
+  EXPECT_TRUE(std::u16string(u"0") == std::u16string(buffer, length));
+}
+#endif
+
+/** 
+ *  Test: Every property name returned by getAttributeName() can be read, and
+ *        an unknown name is reported as unknown for get and set.
+ */
+TEST_F(StatsdStatsWriter_UnitTest, everyPropertyIsReported)
+{
+  StatsdStatsWriter testStatsdStatsWriter;
+
+  CciChar name[64];
+  CciChar value[256];
+  int rc = CCI_FAILURE;
+  int index = 0;
+  for (;; ++index) {
+    CciSize length = testStatsdStatsWriter.getAttributeName(&rc, index, name, 63);
+    if (rc == CCI_ATTRIBUTE_UNKNOWN) {
+      break;
+    }
+    ASSERT_EQ(CCI_SUCCESS, rc);
+    name[length] = 0;
+    testStatsdStatsWriter.getAttribute(&rc, name, value, 256);
+    EXPECT_EQ(CCI_SUCCESS, rc) << "Failed to get property " << utf_to_utf<char>(std::u16string(name));
+  }
+  EXPECT_EQ(23, index);
+
+  testStatsdStatsWriter.getAttribute(&rc, u"noSuchProperty", value, 256);
+  EXPECT_EQ(CCI_ATTRIBUTE_UNKNOWN, rc);
+  testStatsdStatsWriter.setAttribute(&rc, u"noSuchProperty", u"1");
+  EXPECT_EQ(CCI_ATTRIBUTE_UNKNOWN, rc);
+}
+
+extern int cciLogCount;
+
+/** 
+ *  Test: A destination that cannot be resolved is logged, and is not resolved
+ *        again for every record while it keeps failing.
+ */
+TEST_F(StatsdStatsWriter_UnitTest, unresolvedDestinationIsLoggedAndRetried)
+{
+  StatsdStatsWriter testStatsdStatsWriter;
+
+  int rc = CCI_FAILURE;
+  testStatsdStatsWriter.setAttribute(&rc, u"hostname", u"no-such-host.invalid");
+  EXPECT_EQ(CCI_SUCCESS, rc);
+  testStatsdStatsWriter.setAttribute(&rc, u"port", u"8125");
+  EXPECT_EQ(CCI_SUCCESS, rc);
+
+  int logged = cciLogCount;
+  testStatsdStatsWriter.write(&iRecord);
+  EXPECT_EQ(logged + 1, cciLogCount);
+
+  // The next attempt is a second later, so these records do not try again.
+  testStatsdStatsWriter.write(&iRecord);
+  testStatsdStatsWriter.write(&iRecord);
+  EXPECT_EQ(logged + 1, cciLogCount);
+}
@@ -15,6 +15,10 @@
 /* failures; if we didn't use stubs we would have to create an executable with every */
 /* IIB shared library link in, and that brings a lot of static initialisers that are */
 /* complicated to keep happy.                                                        */
+
+//! Number of messages logged, so that tests can check that a failure is reported.
+int cciLogCount = 0;
+
 void ImportExportPrefix ImportExportSuffix cciLogWithInsertsW(
   int*               returnCode,
   CCI_LOG_TYPE       type,
@@ -27,7 +31,7 @@ void ImportExportPrefix ImportExportSuffix cciLogWithInsertsW(
   const CciChar**    inserts,
   CciSize            numInserts)
 {
-  // Ignore this call
+  ++cciLogCount;
 }
 CsiStatsWriter ImportExportPrefix * ImportExportSuffix csiCreateStatsWriter(
   int* returnCode,
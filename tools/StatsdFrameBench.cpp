@@ -0,0 +1,162 @@
+/********************************************************* {COPYRIGHT-TOP} ***
+* Copyright 2016 IBM Corporation
+*
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the MIT License
+* which accompanies this distribution, and is available at
+* http://opensource.org/licenses/MIT
+********************************************************** {COPYRIGHT-END} **/
+
+/*
+ * Measures the bytes and CPU time per metric of the udp and tcp-framed
+ * protocols for a synthetic load:
+ *
+ *   statsd-framebench [-f flows] [-r rounds]
+ *
+ * Each round writes one record for each of the flows (1000 by default), with
+ * the 7 message flow metrics that the writer sends by default, named as the
+ * writer names them. The lines go through UdpSocket's batching and are flushed
+ * after each record, as the writer does, so every record becomes its own UDP
+ * packets or its own frame. Nothing is put on the network: the transmit() hook
+ * only counts the bytes that would be sent, after front-coding them with
+ * FrameEncoder for tcp-framed, exactly as FramedTcpSocket does.
+ */
+
+#include "FrameCodec.hpp"
+#include "FramedTcpSocket.hpp"
+#include "UdpSocket.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+  /*
+   * Batches exactly as for the udp protocol, and counts the bytes of each
+   * datagram instead of sending it.
+   */
+  class CountingSocket : public UdpSocket {
+  public:
+    CountingSocket()
+     : UdpSocket(u"localhost", u"8125", UdpSocket::MAX_PACKET_SIZE, NULL), iBytes(0) {}
+    uint64_t iBytes;
+  protected:
+    virtual bool transmit(const char*, size_t length) {
+      iBytes += length;
+      return true;
+    }
+  };
+
+  /*
+   * Batches and encodes exactly as for the tcp-framed protocol, and counts the
+   * bytes of each frame instead of writing it to a stream.
+   */
+  class FramingSocket : public UdpSocket {
+  public:
+    FramingSocket()
+     : UdpSocket(u"localhost", u"8126", FramedTcpSocket::MAX_BATCH_SIZE, NULL), iBytes(0) {}
+    uint64_t iBytes;
+  protected:
+    virtual bool transmit(const char* packet, size_t length) {
+      iEncoder.reset();
+      const char* end = packet + length;
+      const char* start = packet;
+      for (;;) {
+        const char* newline = std::find(start, end, '\n');
+        iEncoder.append(start, newline - start);
+        if (newline == end) {
+          break;
+        }
+        start = newline + 1;
+      }
+      iBytes += iEncoder.finish().length();
+      return true;
+    }
+    FrameEncoder iEncoder;
+  };
+
+  const char* const METRIC_NAMES[] = {
+    "minimumCPUTime", "maximumCPUTime", "minimumElapsedTime", "maximumElapsedTime",
+    "averageMessageRate", "averageCPUTimePerMessage", "averageElapsedTimePerMessage"
+  };
+  const size_t METRICS_PER_RECORD = sizeof(METRIC_NAMES) / sizeof(METRIC_NAMES[0]);
+
+  /*
+   * Formats the lines for every record of one round, in the writer's format:
+   * hostname.node.server.flow.metric:value|g with the value printed by "%f".
+   */
+  std::vector<std::string> makeLines(int flows) {
+    std::vector<std::string> lines;
+    char buffer[512];
+    for (int flow = 0; flow < flows; ++flow) {
+      snprintf(buffer, sizeof(buffer), "iibprod-host01.PRODNODE1.OrderServices.OrderProcessing_Flow_%04d.", flow);
+      std::string base(buffer);
+      for (size_t metric = 0; metric < METRICS_PER_RECORD; ++metric) {
+        snprintf(buffer, sizeof(buffer), "%f", ((flow * 7919 + metric * 104729) % 100000) / 1000.0);
+        lines.push_back(base + METRIC_NAMES[metric] + ':' + buffer + "|g");
+      }
+    }
+    return lines;
+  }
+
+  /*
+   * Sends every line, flushing after each record, and returns the CPU seconds
+   * taken for all the rounds.
+   */
+  double run(UdpSocket& socket, const std::vector<std::string>& lines, int rounds) {
+    std::clock_t start = std::clock();
+    for (int round = 0; round < rounds; ++round) {
+      for (size_t i = 0; i < lines.size(); ++i) {
+        socket.send(lines[i]);
+        if ((i + 1) % METRICS_PER_RECORD == 0) {
+          socket.flush();
+        }
+      }
+    }
+    return static_cast<double>(std::clock() - start) / CLOCKS_PER_SEC;
+  }
+
+  void report(const char* name, uint64_t bytes, double seconds, double metrics) {
+    printf("%-11s %7.1f bytes/metric %7.1f ns/metric\n", name, bytes / metrics, seconds * 1e9 / metrics);
+  }
+
+}
+
+int main(int argc, char *argv[])
+{
+  int flows = 1000;
+  int rounds = 200;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    if (arg == "-f" && i + 1 < argc) {
+      flows = atoi(argv[++i]);
+    } else if (arg == "-r" && i + 1 < argc) {
+      rounds = atoi(argv[++i]);
+    } else {
+      std::cerr << "usage: statsd-framebench [-f flows] [-r rounds]" << std::endl;
+      return 1;
+    }
+  }
+  if (flows <= 0 || rounds <= 0) {
+    std::cerr << "statsd-framebench: flows and rounds must be positive" << std::endl;
+    return 1;
+  }
+
+  std::vector<std::string> lines = makeLines(flows);
+  double metrics = static_cast<double>(lines.size()) * rounds;
+  printf("%d flows x %u metrics, %d rounds, each record flushed on its own\n",
+         flows, static_cast<unsigned>(METRICS_PER_RECORD), rounds);
+
+  CountingSocket udp;
+  FramingSocket framed;
+  double udpSeconds = run(udp, lines, rounds);
+  double framedSeconds = run(framed, lines, rounds);
+  report("udp", udp.iBytes, udpSeconds, metrics);
+  report("tcp-framed", framed.iBytes, framedSeconds, metrics);
+  return 0;
+}
@@ -0,0 +1,155 @@
+/********************************************************* {COPYRIGHT-TOP} ***
+* Copyright 2016 IBM Corporation
+*
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the MIT License
+* which accompanies this distribution, and is available at
+* http://opensource.org/licenses/MIT
+********************************************************** {COPYRIGHT-END} **/
+
+/*
+ * Replays a file written by the captureFile property through StatsdStatsWriter,
+ * reproducing the production load outside of an integration server:
+ *
+ *   statsd-replay [-s speed] [-H host] [-p name=value]... capturefile
+ *
+ * -s sets the replay speed relative to the original: 1 (the default) keeps the
+ * original pacing, 10 is ten times faster, and 0 replays as fast as possible.
+ * -H sets the host name used in metric names, which is otherwise the local host
+ * name. -p sets a property of the writer, such as hostname, port, or
+ * snapshotMetrics. If no hostname is set, then each metric is printed to stdout
+ * instead of being sent, so that the formatted output can be compared byte for
+ * byte; pin the host name with -H to compare output from different machines.
+ */
+
+#include "RecordCapture.hpp"
+#include "StatsdStatsWriter.hpp"
+#include "UdpSocket.hpp"
+
+#include <boost/locale.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using boost::locale::conv::utf_to_utf;
+
+/*
+ * The writer is built from source, as for the unit tests, and these stand in for
+ * the IBM Integration Bus runtime functions that it calls.
+ */
+void ImportExportPrefix ImportExportSuffix cciLogWithInsertsW(
+  int*               returnCode,
+  CCI_LOG_TYPE       type,
+  const char*        file,
+  int                line,
+  const char*        function,
+  const CciChar*     messageSource,
+  int                messageNumber,
+  const CciChar*     traceText,
+  const CciChar**    inserts,
+  CciSize            numInserts)
+{
+  // Ignore this call
+}
+CsiStatsWriter ImportExportPrefix * ImportExportSuffix csiCreateStatsWriter(
+  int* returnCode,
+  const CciChar* resourceName,
+  const CciChar* formatName,
+  const CsiStatsWriterVft* vft,
+  void* context)
+{
+  *returnCode = CCI_SUCCESS;
+  return NULL;
+}
+
+namespace {
+
+  /*
+   * Prints each metric on its own line rather than sending it.
+   */
+  class StdoutSocket : public UdpSocket {
+  public:
+    StdoutSocket() : UdpSocket(u"", u"", 0, NULL) {}
+    virtual void send(const std::string& data) { std::cout << data << '\n'; }
+    virtual void flush() {}
+  };
+
+  int usage() {
+    std::cerr << "usage: statsd-replay [-s speed] [-H host] [-p name=value]... capturefile" << std::endl;
+    return 2;
+  }
+
+}
+
+int main(int argc, char *argv[])
+{
+  std::ios::sync_with_stdio(false);
+  double speed = 1.0;
+  std::vector<std::pair<std::u16string, std::u16string> > properties;
+  std::string metricHostname;
+  bool hostname = false;
+  int arg = 1;
+  for (; arg < argc - 1; ++arg) {
+    std::string option(argv[arg]);
+    if (option == "-s") {
+      speed = std::atof(argv[++arg]);
+    } else if (option == "-H") {
+      metricHostname = argv[++arg];
+    } else if (option == "-p") {
+      std::string property(argv[++arg]);
+      size_t equals = property.find('=');
+      if (equals == std::string::npos) {
+        return usage();
+      }
+      properties.push_back(std::make_pair(utf_to_utf<char16_t>(property.substr(0, equals)),
+                                          utf_to_utf<char16_t>(property.substr(equals + 1))));
+      if (property.compare(0, equals, "hostname") == 0) {
+        hostname = (equals + 1 < property.length());
+      }
+    } else {
+      return usage();
+    }
+  }
+  if (arg != argc - 1 || speed < 0) {
+    return usage();
+  }
+
+  try {
+    CaptureReader reader(argv[arg]);
+    StatsdStatsWriter writer(hostname ? NULL : new StdoutSocket());
+    if (!metricHostname.empty()) {
+      writer.setMetricHostname(metricHostname);
+    }
+    for (size_t i = 0; i < properties.size(); ++i) {
+      int rc = CCI_FAILURE;
+      writer.setAttribute(&rc, properties[i].first.c_str(), properties[i].second.c_str());
+      if (rc != CCI_SUCCESS) {
+        std::cerr << "statsd-replay: cannot set property " << utf_to_utf<char>(properties[i].first) << std::endl;
+        return 1;
+      }
+    }
+
+    CsiStatsRecord record;
+    uint64_t elapsedMillis = 0;
+    uint64_t records = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    while (reader.next(record, elapsedMillis)) {
+      if (speed > 0) {
+        std::this_thread::sleep_until(start + std::chrono::microseconds(static_cast<int64_t>((elapsedMillis * 1000) / speed)));
+      }
+      writer.write(&record);
+      ++records;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout.flush();
+    std::cerr << "statsd-replay: " << records << " records in " << seconds << "s" << std::endl;
+  } catch (const std::exception& e) {
+    std::cerr << "statsd-replay: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,59 @@
+/********************************************************* {COPYRIGHT-TOP} ***
+* Copyright 2016 IBM Corporation
+*
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the MIT License
+* which accompanies this distribution, and is available at
+* http://opensource.org/licenses/MIT
+********************************************************** {COPYRIGHT-END} **/
+
+/*
+ * Decodes a tcp-framed stream on stdin into plain StatsD lines on stdout,
+ * one metric per line. Typical use on the relay host:
+ *
+ *   nc -lk 8126 | statsd-unframe | nc -u localhost 8125
+ */
+
+#include "FrameCodec.hpp"
+
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+int main(int argc, char *argv[])
+{
+  std::ios::sync_with_stdio(false);
+  FrameDecoder decoder;
+  std::string line;
+  std::vector<char> frame;
+  try {
+    /*
+     * Read exactly one frame at a time, so that each frame's lines are written
+     * as soon as it arrives rather than when a larger read fills up.
+     */
+    frame.resize(FrameEncoder::HEADER_SIZE);
+    while (std::cin.read(&frame[0], FrameEncoder::HEADER_SIZE)) {
+      size_t payloadLength = FrameDecoder::payloadLength(&frame[0]);
+      if (payloadLength > FrameDecoder::MAX_FRAME_SIZE) {
+        throw std::runtime_error("Frame exceeds maximum size");
+      }
+      frame.resize(FrameEncoder::HEADER_SIZE + payloadLength);
+      if (payloadLength != 0 && !std::cin.read(&frame[FrameEncoder::HEADER_SIZE], payloadLength)) {
+        throw std::runtime_error("Truncated frame");
+      }
+      decoder.feed(&frame[0], frame.size());
+      while (decoder.next(line)) {
+        std::cout << line << '\n';
+      }
+      std::cout.flush();
+    }
+    if (std::cin.gcount() != 0) {
+      throw std::runtime_error("Truncated frame");
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "statsd-unframe: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}